@@ -1,3 +1,20 @@
+// This program computes the mean of the videos stored in a lmdb/leveldb.
+// Usage:
+//   compute_video_mean [FLAGS] INPUT_DB OUTPUT_FILE [DB_BACKEND]
+//
+// --mode selects what is averaged:
+//   pixel:   one image over all the frames, 1 x channels x height x width;
+//   frame:   one image per position of a centered window of --frames frames,
+//            --frames x channels x height x width;
+//   channel: one value per channel, 1 x channels x 1 x 1.
+// The entries are split over --threads threads in contiguous ranges of keys,
+// found by one pass over the keys. Each thread seeks its own cursor to the
+// start of its range, sums the range in double precision, and the partial
+// sums are added up pairwise at the end.
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <leveldb/db.h>
 #include <lmdb.h>
@@ -5,172 +22,395 @@
 
 #include <algorithm>
 #include <string>
+#include <vector>
 
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/video_io.hpp"
 
 using caffe::Datum;
 using caffe::BlobProto;
 using std::string;
+using std::vector;
 using std::max;
 
+DEFINE_string(mode, "pixel",
+    "What the mean is computed over: pixel, frame or channel");
+DEFINE_int32(frames, 16,
+    "Length of the centered window whose positions are averaged in frame "
+    "mode; should match video_crop_size_t");
+DEFINE_int32(threads, 1, "Number of threads reading the database");
+
+enum MeanMode { PIXEL, FRAME, CHANNEL };
+
+// A database opened once by main() and shared by the threads.
+struct Database {
+  string backend;
+  // leveldb
+  leveldb::DB* db;
+  // lmdb
+  MDB_env* mdb_env;
+  MDB_dbi mdb_dbi;
+};
+
+// A cursor of its own over a Database, so that every thread can walk the
+// entries independently.
+class Cursor {
+ public:
+  explicit Cursor(const Database& db) : backend_(db.backend), it_(NULL) {
+    if (backend_ == "leveldb") {  // leveldb
+      leveldb::ReadOptions read_options;
+      read_options.fill_cache = false;
+      it_ = db.db->NewIterator(read_options);
+      it_->SeekToFirst();
+      valid_ = it_->Valid();
+    } else {  // lmdb
+      CHECK_EQ(mdb_txn_begin(db.mdb_env, NULL, MDB_RDONLY, &mdb_txn_),
+          MDB_SUCCESS) << "mdb_txn_begin failed";
+      CHECK_EQ(mdb_cursor_open(mdb_txn_, db.mdb_dbi, &mdb_cursor_),
+          MDB_SUCCESS) << "mdb_cursor_open failed";
+      valid_ = mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_FIRST)
+          == MDB_SUCCESS;
+    }
+  }
+  ~Cursor() {
+    if (backend_ == "leveldb") {  // leveldb
+      delete it_;
+    } else {  // lmdb
+      mdb_cursor_close(mdb_cursor_);
+      mdb_txn_abort(mdb_txn_);
+    }
+  }
+  bool valid() const { return valid_; }
+  string key() const {
+    if (backend_ == "leveldb") {  // leveldb
+      return it_->key().ToString();
+    } else {  // lmdb
+      return string(static_cast<const char*>(mdb_key_.mv_data),
+                    mdb_key_.mv_size);
+    }
+  }
+  // Moves to the entry of key, which must exist.
+  void Seek(const string& key) {
+    if (backend_ == "leveldb") {  // leveldb
+      it_->Seek(key);
+      valid_ = it_->Valid() && it_->key().ToString() == key;
+    } else {  // lmdb
+      mdb_key_.mv_size = key.size();
+      mdb_key_.mv_data = const_cast<char*>(key.data());
+      valid_ = mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+          MDB_SET_KEY) == MDB_SUCCESS;
+    }
+    CHECK(valid_) << "Key " << key << " not found";
+  }
+  void Next() {
+    if (backend_ == "leveldb") {  // leveldb
+      it_->Next();
+      valid_ = it_->Valid();
+    } else {  // lmdb
+      valid_ = mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
+          == MDB_SUCCESS;
+    }
+  }
+  void ParseDatum(Datum* datum) const {
+    if (backend_ == "leveldb") {  // leveldb
+      datum->ParseFromString(it_->value().ToString());
+    } else {  // lmdb
+      datum->ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
+    }
+  }
+
+ private:
+  const string backend_;
+  bool valid_;
+  // leveldb
+  leveldb::Iterator* it_;
+  // lmdb
+  MDB_txn* mdb_txn_;
+  MDB_cursor* mdb_cursor_;
+  MDB_val mdb_key_, mdb_value_;
+};
+
+// Layout of the mean: num_slots slots of slot_size values. Every value of a
+// slot is divided by the number of values added to that slot.
+struct MeanShape {
+  MeanMode mode;
+  int channels;
+  int height;
+  int width;
+  int num_slots;
+  int slot_size;
+};
+
+// The sums of one thread.
+struct MeanSum {
+  vector<double> sum;
+  vector<int64_t> count;
+  int videos;
+};
+
+// Adds a uint8 frame to the slot starting at slot_sum.
+static void AddFrame(const MeanShape& shape, const char* frame,
+    double* slot_sum) {
+  const int plane_size = shape.height * shape.width;
+  for (int c = 0; c < shape.channels; ++c) {
+    if (shape.mode == CHANNEL) {
+      double channel_sum = 0;
+      for (int j = 0; j < plane_size; ++j) {
+        channel_sum += static_cast<uint8_t>(frame[c * plane_size + j]);
+      }
+      slot_sum[c] += channel_sum;
+    } else {
+      for (int j = 0; j < plane_size; ++j) {
+        slot_sum[c * plane_size + j] +=
+            static_cast<uint8_t>(frame[c * plane_size + j]);
+      }
+    }
+  }
+}
+
+// Adds a float frame to the slot starting at slot_sum.
+static void AddFrame(const MeanShape& shape, const float* frame,
+    double* slot_sum) {
+  const int plane_size = shape.height * shape.width;
+  for (int c = 0; c < shape.channels; ++c) {
+    for (int j = 0; j < plane_size; ++j) {
+      slot_sum[shape.mode == CHANNEL ? c : c * plane_size + j] +=
+          frame[c * plane_size + j];
+    }
+  }
+}
+
+// Sums the num_videos entries of db starting at first_key.
+static void SumVideos(const Database& db, const MeanShape& shape,
+    const int thread_id, const string& first_key, const int num_videos,
+    MeanSum* mean_sum) {
+  const int frame_size = shape.channels * shape.height * shape.width;
+  mean_sum->sum.assign(shape.num_slots * shape.slot_size, 0.);
+  mean_sum->count.assign(shape.num_slots, 0);
+  mean_sum->videos = 0;
+  Datum datum;
+  string decoded;
+  vector<int> frame_ids;
+  if (num_videos == 0) {
+    return;
+  }
+  Cursor cursor(db);
+  cursor.Seek(first_key);
+  for (int index = 0; index < num_videos; cursor.Next(), ++index) {
+    CHECK(cursor.valid()) << "The database changed while being read";
+    cursor.ParseDatum(&datum);
+    CHECK_EQ(datum.channels(), shape.channels);
+    CHECK_EQ(datum.height(), shape.height);
+    CHECK_EQ(datum.width(), shape.width);
+    const int frames = datum.encoded_frames_size() > 0 ?
+        datum.encoded_frames_size() : datum.frames();
+    // Frame first_frame + i is added to slot first_slot + i in frame mode,
+    // whose window is centered on the video like the transformer does at
+    // test time; the other modes add every frame to slot 0.
+    int first_frame = 0;
+    int first_slot = 0;
+    int num_frames = frames;
+    if (shape.mode == FRAME) {
+      if (frames >= shape.num_slots) {
+        first_frame = (frames - shape.num_slots) / 2;
+        num_frames = shape.num_slots;
+      } else {
+        first_slot = (shape.num_slots - frames) / 2;
+      }
+    }
+    const char* data = datum.data().data();
+    if (datum.encoded_frames_size() > 0) {
+      // only decode the frames that are averaged
+      frame_ids.resize(num_frames);
+      for (int i = 0; i < num_frames; ++i) {
+        frame_ids[i] = first_frame + i;
+      }
+      decoded.resize(static_cast<size_t>(num_frames) * frame_size);
+      CHECK(caffe::DecodeVideoFrames(datum, frame_ids, 1, &decoded[0]));
+      data = decoded.data();
+      first_frame = 0;
+    } else if (datum.data().size() == 0) {
+      CHECK_EQ(datum.float_data_size(), frames * frame_size);
+    } else {
+      CHECK_EQ(datum.data().size(), frames * frame_size);
+    }
+    const int plane_count = shape.mode == CHANNEL ?
+        shape.height * shape.width : 1;
+    for (int i = 0; i < num_frames; ++i) {
+      const int slot = shape.mode == FRAME ? first_slot + i : 0;
+      double* slot_sum = &mean_sum->sum[slot * shape.slot_size];
+      const size_t offset = static_cast<size_t>(first_frame + i) * frame_size;
+      if (datum.data().size() > 0 || datum.encoded_frames_size() > 0) {
+        AddFrame(shape, data + offset, slot_sum);
+      } else {
+        AddFrame(shape, datum.float_data().data() + offset, slot_sum);
+      }
+      mean_sum->count[slot] += plane_count;
+    }
+    if (++mean_sum->videos % 100 == 0) {
+      LOG(ERROR) << "Thread " << thread_id << " processed "
+                 << mean_sum->videos << " videos.";
+    }
+  }
+}
+
+// Adds the sums of src to dst.
+static void AddSums(const MeanSum* src, MeanSum* dst) {
+  for (int i = 0; i < dst->sum.size(); ++i) {
+    dst->sum[i] += src->sum[i];
+  }
+  for (int i = 0; i < dst->count.size(); ++i) {
+    dst->count[i] += src->count[i];
+  }
+  dst->videos += src->videos;
+}
+
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compute the mean of the videos in a leveldb/lmdb\n"
+        "Usage:\n"
+        "    compute_video_mean [FLAGS] INPUT_DB OUTPUT_FILE "
+        "[DB_BACKEND (leveldb or lmdb)]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
   if (argc < 3 || argc > 4) {
-    LOG(ERROR) << "Usage: compute_video_mean input_db output_file"
-               << " db_backend[leveldb or lmdb]";
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "examples/ucf-101/compute_video_mean");
     return 1;
   }
+  CHECK_GT(FLAGS_threads, 0) << "--threads must be positive";
 
-  string db_backend = "lmdb";
+  Database db;
+  db.backend = "lmdb";
   if (argc == 4) {
-    db_backend = string(argv[3]);
+    db.backend = string(argv[3]);
   }
 
-  // leveldb
-  leveldb::DB* db;
-  leveldb::Options options;
-  options.create_if_missing = false;
-  leveldb::Iterator* it = NULL;
-  // lmdb
-  MDB_env* mdb_env;
-  MDB_dbi mdb_dbi;
-  MDB_val mdb_key, mdb_value;
-  MDB_txn* mdb_txn;
-  MDB_cursor* mdb_cursor;
-
   // Open db
-  if (db_backend == "leveldb") {  // leveldb
+  if (db.backend == "leveldb") {  // leveldb
+    leveldb::Options options;
+    options.create_if_missing = false;
     LOG(INFO) << "Opening leveldb " << argv[1];
     leveldb::Status status = leveldb::DB::Open(
-        options, argv[1], &db);
+        options, argv[1], &db.db);
     CHECK(status.ok()) << "Failed to open leveldb " << argv[1];
-    leveldb::ReadOptions read_options;
-    read_options.fill_cache = false;
-    it = db->NewIterator(read_options);
-    it->SeekToFirst();
-  } else if (db_backend == "lmdb") {  // lmdb
+  } else if (db.backend == "lmdb") {  // lmdb
     LOG(INFO) << "Opening lmdb " << argv[1];
-    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS);  // 1TB
-    CHECK_EQ(mdb_env_open(mdb_env, argv[1], MDB_RDONLY, 0664),
+    MDB_txn* mdb_txn;
+    CHECK_EQ(mdb_env_create(&db.mdb_env), MDB_SUCCESS)
+        << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(db.mdb_env, 1099511627776),
+        MDB_SUCCESS);  // 1TB
+    CHECK_EQ(mdb_env_set_maxreaders(db.mdb_env, FLAGS_threads + 1),
+        MDB_SUCCESS) << "mdb_env_set_maxreaders failed";
+    CHECK_EQ(mdb_env_open(db.mdb_env, argv[1], MDB_RDONLY, 0664),
         MDB_SUCCESS) << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
+    CHECK_EQ(mdb_txn_begin(db.mdb_env, NULL, MDB_RDONLY, &mdb_txn),
+        MDB_SUCCESS) << "mdb_txn_begin failed";
+    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &db.mdb_dbi), MDB_SUCCESS)
         << "mdb_open failed";
-    CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor), MDB_SUCCESS)
-        << "mdb_cursor_open failed";
-    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
+    // Committing makes the handle usable by the transactions of the threads.
+    CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
   } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+    LOG(FATAL) << "Unknown db backend " << db.backend;
   }
 
+  // load first datum and the keys
   Datum datum;
-  BlobProto sum_blob;
-  int count = 0;
-  int video_count = 0;
-  // load first datum
-  if (db_backend == "leveldb") {
-    datum.ParseFromString(it->value().ToString());
-  } else if (db_backend == "lmdb") {
-    datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
-  }
-
-  sum_blob.set_num(1);
-  sum_blob.set_channels(datum.channels());
-  sum_blob.set_height(datum.height());
-  sum_blob.set_width(datum.width());
-  const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < data_size; ++i) {
-    sum_blob.add_data(0.);
-  }
-  LOG(INFO) << "Starting Iteration";
-  if (db_backend == "leveldb") {  // leveldb
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-      // just a dummy operation
-      datum.ParseFromString(it->value().ToString());
-      const string& data = datum.data();
-      // added by sxyu
-      if ( data.size() != 0 ) {
-        for ( int i = 0; i < datum.frames(); ++i ) {
-          for ( int j = 0; j < data_size; ++j ) {
-            sum_blob.set_data(j, sum_blob.data(j) + (uint8_t)data[i*data_size+j]);
-          }
-        }
-      } else {
-        for ( int i = 0; i < datum.frames(); ++i ) {
-          for ( int j = 0; j < data_size; ++j ) {
-            sum_blob.set_data(j, sum_blob.data(j) + 
-                static_cast<float>(datum.float_data(i*data_size+j)));
-          }
-        }
-      }
-      count += datum.frames();
-      video_count++;
-      if (video_count % 100== 0) {
-        LOG(ERROR) << "Processed " << video_count << " videos.";
-      }
+  vector<string> keys;
+  {
+    Cursor cursor(db);
+    CHECK(cursor.valid()) << "The database is empty";
+    cursor.ParseDatum(&datum);
+    for (; cursor.valid(); cursor.Next()) {
+      keys.push_back(cursor.key());
     }
-  } else if (db_backend == "lmdb") {  // lmdb
-    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
-    do {
-      // just a dummy operation
-      datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-      const string& data = datum.data();
-      // added by sxyu
-      if ( data.size() != 0 ) {
-        for ( int i = 0; i < datum.frames(); ++i ) {
-          for ( int j = 0; j < data_size; ++j ) {
-            sum_blob.set_data(j, sum_blob.data(j) + (uint8_t)data[i*data_size+j]);
-          }
-        }
-      } else {
-        for ( int i = 0; i < datum.frames(); ++i ) {
-          for ( int j = 0; j < data_size; ++j ) {
-            sum_blob.set_data(j, sum_blob.data(j) + 
-                static_cast<float>(datum.float_data(i*data_size+j)));
-          }
-        }
-      }
-      count += datum.frames();  
-      video_count++;
-
-      if (video_count % 100== 0) {
-        LOG(ERROR) << "Processed " << video_count << " videos.";
-      }
-    } while (mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT)
-        == MDB_SUCCESS);
+  }
+  MeanShape shape;
+  shape.channels = datum.channels();
+  shape.height = datum.height();
+  shape.width = datum.width();
+  shape.num_slots = 1;
+  shape.slot_size = shape.channels * shape.height * shape.width;
+  if (FLAGS_mode == "pixel") {
+    shape.mode = PIXEL;
+  } else if (FLAGS_mode == "frame") {
+    CHECK_GT(FLAGS_frames, 0) << "--frames must be positive";
+    shape.mode = FRAME;
+    shape.num_slots = FLAGS_frames;
+  } else if (FLAGS_mode == "channel") {
+    shape.mode = CHANNEL;
+    shape.slot_size = shape.channels;
   } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+    LOG(FATAL) << "Unknown mean mode " << FLAGS_mode;
+  }
+
+  LOG(INFO) << "Starting Iteration over " << keys.size() << " videos";
+  // Thread i sums the entries from keys[begins[i]] to keys[begins[i + 1]].
+  vector<int> begins(FLAGS_threads + 1);
+  for (int i = 0; i < FLAGS_threads; ++i) {
+    caffe::ThreadRange(keys.size(), i, FLAGS_threads, &begins[i],
+                       &begins[i + 1]);
+  }
+  vector<string> first_keys(FLAGS_threads);
+  for (int i = 0; i < FLAGS_threads; ++i) {
+    if (begins[i] < keys.size()) {
+      first_keys[i] = keys[begins[i]];
+    }
   }
+  keys.clear();
+  vector<MeanSum> sums(FLAGS_threads);
+  boost::thread_group threads;
+  for (int i = 1; i < FLAGS_threads; ++i) {
+    threads.create_thread(boost::bind(&SumVideos, boost::cref(db),
+        boost::cref(shape), i, boost::cref(first_keys[i]),
+        begins[i + 1] - begins[i], &sums[i]));
+  }
+  SumVideos(db, shape, 0, first_keys[0], begins[1] - begins[0], &sums[0]);
+  threads.join_all();
+  // Add the partial sums up pairwise, a level of the tree at a time.
+  for (int stride = 1; stride < FLAGS_threads; stride *= 2) {
+    boost::thread_group adders;
+    for (int i = 0; i + stride < FLAGS_threads; i += 2 * stride) {
+      adders.create_thread(boost::bind(&AddSums, &sums[i + stride],
+          &sums[i]));
+    }
+    adders.join_all();
+  }
+  const MeanSum& total = sums[0];
+  LOG(ERROR) << "Processed " << total.videos << " videos.";
 
-  if (video_count % 100!= 0) {
-    LOG(ERROR) << "Processed " << video_count << " videos.";
+  BlobProto sum_blob;
+  sum_blob.set_num(shape.num_slots);
+  sum_blob.set_channels(shape.channels);
+  if (shape.mode == CHANNEL) {
+    sum_blob.set_height(1);
+    sum_blob.set_width(1);
+  } else {
+    sum_blob.set_height(shape.height);
+    sum_blob.set_width(shape.width);
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  for (int i = 0; i < total.sum.size(); ++i) {
+    const int64_t count = total.count[i / shape.slot_size];
+    sum_blob.add_data(count > 0 ? total.sum[i] / count : 0.);
   }
   // Write to disk
   LOG(INFO) << "Write to " << argv[2];
   WriteProtoToBinaryFile(sum_blob, argv[2]);
 
   // Clean up
-  if (db_backend == "leveldb") {
-    delete db;
-  } else if (db_backend == "lmdb") {
-    mdb_cursor_close(mdb_cursor);
-    mdb_close(mdb_env, mdb_dbi);
-    mdb_txn_abort(mdb_txn);
-    mdb_env_close(mdb_env);
+  if (db.backend == "leveldb") {
+    delete db.db;
   } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+    mdb_close(db.mdb_env, db.mdb_dbi);
+    mdb_env_close(db.mdb_env);
   }
   return 0;
 }
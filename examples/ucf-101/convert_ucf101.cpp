@@ -7,20 +7,38 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.mp4 7
 //   ....
+//
+// The videos are decoded by --threads threads, which hand them to one writer
+// thread per database through a bounded queue. With --shards=N, the videos
+// are split round-robin over the databases DB_NAME_0 ... DB_NAME_<N-1>, which
+// are written in parallel.
+//
+// With --resume, existing databases are opened instead of created, and only
+// the videos of LISTFILE that none of them holds yet are converted. This
+// continues an interrupted conversion, or appends the new videos of an
+// updated list.
 
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
+#include <errno.h>
 #include <lmdb.h>
 #include <sys/stat.h>
 
 #include <algorithm>
+#include <deque>
 #include <fstream>  // NOLINT(readability/streams)
+#include <set>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
 #include "caffe/util/video_io.hpp"
@@ -30,6 +48,7 @@
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
 using std::string;
+using std::vector;
 
 DEFINE_bool(gray, false,
     "When this option is on, treat images as grayscale ones");
@@ -38,6 +57,332 @@ DEFINE_bool(shuffle, false,
 DEFINE_string(backend, "lmdb", "The backend for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
+DEFINE_int32(short_side, 0,
+    "Length the shorter side of the frames is resized to, preserving their "
+    "aspect ratio; overrides resize_height and resize_width");
+DEFINE_int32(max_side, 0,
+    "Length the longer side of the frames is resized to, preserving their "
+    "aspect ratio; overrides resize_height and resize_width");
+DEFINE_string(interpolation, "",
+    "Interpolation of the resize: nearest, linear, cubic or area; by default "
+    "area when shrinking and linear when enlarging");
+DEFINE_double(fps, 0,
+    "Frame rate the videos are resampled to by dropping frames; 0 keeps the "
+    "source rate");
+DEFINE_int32(max_frames, 0,
+    "Maximum number of frames kept from the start of each video; 0 keeps all");
+DEFINE_bool(encode_frames, false,
+    "When this option is on, store every frame as an encoded image");
+DEFINE_string(encode_type, "jpg",
+    "The image format the frames are encoded to, e.g. jpg or png");
+DEFINE_int32(threads, 1, "Number of threads decoding the videos");
+DEFINE_int32(shards, 1,
+    "Number of databases DB_NAME_0, DB_NAME_1, ... written in parallel; "
+    "1 writes DB_NAME itself");
+DEFINE_int32(queue_size, 64,
+    "Maximum number of decoded videos waiting for the writer of a database");
+DEFINE_bool(resume, false,
+    "Add the videos missing from existing databases instead of creating "
+    "new ones");
+DEFINE_int32(seed, -1,
+    "Random seed used by --shuffle; a negative value picks a random one");
+
+// Average number of frames converted per second since start_time.
+static float FramesPerSecond(const int64_t frame_count,
+    const boost::posix_time::ptime& start_time) {
+  const float seconds = (boost::posix_time::microsec_clock::local_time()
+      - start_time).total_milliseconds() / 1000.;
+  return seconds > 0 ? frame_count / seconds : 0;
+}
+
+// A converted video waiting to be written.
+struct DBEntry {
+  string key;
+  string value;
+  int frames;
+};
+
+// Bounded queue between the decode threads and the writer of one database,
+// so that fast decoders cannot pile up videos faster than they are written.
+// A NULL entry tells the writer that no more videos will come.
+class EntryQueue {
+ public:
+  explicit EntryQueue(const int capacity) : capacity_(capacity) {}
+  void Push(DBEntry* entry) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.size() >= capacity_) {
+      not_full_.wait(lock);
+    }
+    queue_.push_back(entry);
+    not_empty_.notify_one();
+  }
+  DBEntry* Pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) {
+      not_empty_.wait(lock);
+    }
+    DBEntry* entry = queue_.front();
+    queue_.pop_front();
+    not_full_.notify_one();
+    return entry;
+  }
+
+ private:
+  const size_t capacity_;
+  std::deque<DBEntry*> queue_;
+  boost::mutex mutex_;
+  boost::condition_variable not_full_;
+  boost::condition_variable not_empty_;
+};
+
+// Keys are the line index, an underscore, and the filename of the video.
+static string LineKey(const int line_id, const string& filename) {
+  char prefix[16];
+  snprintf(prefix, sizeof(prefix), "%08d_", line_id);
+  return prefix + filename;
+}
+
+// The filename of a key made by LineKey, which follows the first underscore;
+// the line index has none.
+static string KeyFilename(const string& key) {
+  const size_t separator = key.find('_');
+  CHECK(separator != string::npos && separator + 1 < key.size())
+      << "Unexpected key " << key;
+  return key.substr(separator + 1);
+}
+
+// Writes entries to a lmdb or leveldb, committing every kCommitSize entries.
+// The database is created unless resume is set, in which case an existing
+// one is opened if there is one.
+class DBWriter {
+ public:
+  DBWriter(const string& backend, const string& path, const bool resume)
+      : backend_(backend), path_(path), count_(0), frame_count_(0),
+        batch_(NULL) {
+    if (backend_ == "leveldb") {  // leveldb
+      leveldb::Options options;
+      options.error_if_exists = !resume;
+      options.create_if_missing = true;
+      options.write_buffer_size = 268435456;
+      LOG(INFO) << "Opening leveldb " << path_;
+      leveldb::Status status = leveldb::DB::Open(options, path_, &db_);
+      CHECK(status.ok()) << "Failed to open leveldb " << path_
+          << ". Is it already existing?";
+      batch_ = new leveldb::WriteBatch();
+    } else if (backend_ == "lmdb") {  // lmdb
+      LOG(INFO) << "Opening lmdb " << path_;
+      if (mkdir(path_.c_str(), 0744) != 0) {
+        CHECK(resume && errno == EEXIST) << "mkdir " << path_ << " failed";
+        LOG(INFO) << "Resuming " << path_;
+      }
+      CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS)
+          << "mdb_env_create failed";
+      CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776), MDB_SUCCESS)  // 1TB
+          << "mdb_env_set_mapsize failed";
+      CHECK_EQ(mdb_env_open(mdb_env_, path_.c_str(), 0, 0664), MDB_SUCCESS)
+          << "mdb_env_open failed";
+      CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn_), MDB_SUCCESS)
+          << "mdb_txn_begin failed";
+      CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
+          << "mdb_open failed. Does the lmdb already exist?";
+      CHECK_EQ(mdb_txn_commit(mdb_txn_), MDB_SUCCESS)
+          << "mdb_txn_commit failed";
+      // The write transactions are begun by the thread that calls Put,
+      // since an lmdb transaction must stay on the thread that began it.
+      mdb_txn_ = NULL;
+    } else {
+      LOG(FATAL) << "Unknown db backend " << backend_;
+    }
+    start_time_ = boost::posix_time::microsec_clock::local_time();
+  }
+
+  // Adds the filenames of the videos already in the database to filenames.
+  void ReadFilenames(std::set<string>* filenames) {
+    if (backend_ == "leveldb") {  // leveldb
+      leveldb::Iterator* it = db_->NewIterator(leveldb::ReadOptions());
+      for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        AddFilename(it->key().ToString(), filenames);
+      }
+      delete it;
+    } else {  // lmdb
+      MDB_txn* mdb_txn;
+      MDB_cursor* mdb_cursor;
+      MDB_val mdb_key, mdb_data;
+      CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn),
+          MDB_SUCCESS) << "mdb_txn_begin failed";
+      CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi_, &mdb_cursor), MDB_SUCCESS)
+          << "mdb_cursor_open failed";
+      int rc = mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_data, MDB_FIRST);
+      while (rc == MDB_SUCCESS) {
+        AddFilename(string(static_cast<const char*>(mdb_key.mv_data),
+            mdb_key.mv_size), filenames);
+        rc = mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_data, MDB_NEXT);
+      }
+      mdb_cursor_close(mdb_cursor);
+      mdb_txn_abort(mdb_txn);
+    }
+  }
+
+  void Put(const DBEntry& entry) {
+    if (backend_ == "leveldb") {  // leveldb
+      batch_->Put(entry.key, entry.value);
+    } else {  // lmdb
+      if (mdb_txn_ == NULL) {
+        CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn_), MDB_SUCCESS)
+            << "mdb_txn_begin failed";
+      }
+      MDB_val mdb_key, mdb_data;
+      mdb_data.mv_size = entry.value.size();
+      mdb_data.mv_data = const_cast<char*>(entry.value.data());
+      mdb_key.mv_size = entry.key.size();
+      mdb_key.mv_data = const_cast<char*>(entry.key.data());
+      CHECK_EQ(mdb_put(mdb_txn_, mdb_dbi_, &mdb_key, &mdb_data, 0),
+               MDB_SUCCESS) << "mdb_put failed";
+    }
+    frame_count_ += entry.frames;
+    if (++count_ % kCommitSize == 0) {
+      Commit();
+    }
+  }
+
+  // Writes the last batch and closes the database.
+  void Close() {
+    Commit();
+    if (backend_ == "leveldb") {  // leveldb
+      delete batch_;
+      delete db_;
+    } else {  // lmdb
+      mdb_close(mdb_env_, mdb_dbi_);
+      mdb_env_close(mdb_env_);
+    }
+  }
+
+ private:
+  static const int kCommitSize = 20;
+
+  static void AddFilename(const string& key, std::set<string>* filenames) {
+    filenames->insert(KeyFilename(key));
+  }
+
+  // Commits the pending entries.
+  void Commit() {
+    if (backend_ == "leveldb") {  // leveldb
+      db_->Write(leveldb::WriteOptions(), batch_);
+      delete batch_;
+      batch_ = new leveldb::WriteBatch();
+    } else if (mdb_txn_ != NULL) {  // lmdb
+      CHECK_EQ(mdb_txn_commit(mdb_txn_), MDB_SUCCESS)
+          << "mdb_txn_commit failed";
+      mdb_txn_ = NULL;
+    }
+    LOG(ERROR) << path_ << ": processed " << count_ << " files, "
+               << FramesPerSecond(frame_count_, start_time_) << " frames/sec.";
+  }
+
+  const string backend_;
+  const string path_;
+  int count_;
+  int64_t frame_count_;
+  boost::posix_time::ptime start_time_;
+  // leveldb
+  leveldb::DB* db_;
+  leveldb::WriteBatch* batch_;
+  // lmdb
+  MDB_env* mdb_env_;
+  MDB_dbi mdb_dbi_;
+  MDB_txn* mdb_txn_;
+};
+
+// Hands out the lines to convert to the decode threads.
+class LineDispenser {
+ public:
+  explicit LineDispenser(const vector<int>& line_ids)
+      : line_ids_(line_ids), next_(0) {}
+  // Returns false once every line has been handed out.
+  bool Next(int* line_id) {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (next_ >= line_ids_.size()) {
+      return false;
+    }
+    *line_id = line_ids_[next_++];
+    return true;
+  }
+
+ private:
+  const vector<int>& line_ids_;
+  size_t next_;
+  boost::mutex mutex_;
+};
+
+// The cv::resize interpolation named name, or -1 for the reader's default.
+static int Interpolation(const string& name) {
+  if (name.empty()) {
+    return -1;
+  } else if (name == "nearest") {
+    return cv::INTER_NEAREST;
+  } else if (name == "linear") {
+    return cv::INTER_LINEAR;
+  } else if (name == "cubic") {
+    return cv::INTER_CUBIC;
+  } else if (name == "area") {
+    return cv::INTER_AREA;
+  }
+  LOG(FATAL) << "Unknown interpolation " << name;
+  return -1;
+}
+
+// Decodes the lines handed out by dispenser and queues each video for the
+// database of its shard. The keys start with the line index, so the content
+// of the databases does not depend on the order the threads finish in.
+static void DecodeVideos(const string& root_folder,
+    const vector<pair<string, int> >& lines, LineDispenser* dispenser,
+    const vector<shared_ptr<EntryQueue> >& queues) {
+  const bool is_color = !FLAGS_gray;
+  const int resize_height = std::max<int>(0, FLAGS_resize_height);
+  const int resize_width = std::max<int>(0, FLAGS_resize_width);
+  DatumVideoReader videoReader;
+  if (FLAGS_short_side > 0) {
+    videoReader.set_resize_mode(DatumVideoReader::RESIZE_SHORT_SIDE,
+                                FLAGS_short_side);
+  } else if (FLAGS_max_side > 0) {
+    videoReader.set_resize_mode(DatumVideoReader::RESIZE_MAX_SIDE,
+                                FLAGS_max_side);
+  }
+  videoReader.set_interpolation(Interpolation(FLAGS_interpolation));
+  Datum datum;
+  int line_id;
+  while (dispenser->Next(&line_id)) {
+    if (!videoReader.ReadVideoToDatum(root_folder + lines[line_id].first,
+        lines[line_id].second, resize_height, resize_width, is_color,
+        FLAGS_fps, FLAGS_max_frames, &datum)) {
+      continue;
+    }
+    const int data_size =
+        datum.frames() * datum.channels() * datum.height() * datum.width();
+    const string& data = datum.data();
+    CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
+          << data.size();
+    if (FLAGS_encode_frames &&
+        !EncodeVideoDatum(FLAGS_encode_type, &datum)) {
+      continue;
+    }
+    DBEntry* entry = new DBEntry();
+    // sequential
+    entry->key = LineKey(line_id, lines[line_id].first);
+    datum.SerializeToString(&entry->value);
+    entry->frames = datum.frames();
+    queues[line_id % queues.size()]->Push(entry);
+  }
+}
+
+// Writes the entries of queue until it yields NULL.
+static void WriteVideos(EntryQueue* queue, DBWriter* writer) {
+  for (DBEntry* entry = queue->Pop(); entry != NULL; entry = queue->Pop()) {
+    writer->Put(*entry);
+    delete entry;
+  }
+  writer->Close();
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -58,11 +403,14 @@ int main(int argc, char** argv) {
     gflags::ShowUsageWithFlagsRestrict(argv[0], "examples/ucf-101/convert_ucf101");
     return 1;
   }
+  CHECK_GT(FLAGS_threads, 0) << "--threads must be positive";
+  CHECK_GT(FLAGS_shards, 0) << "--shards must be positive";
+  CHECK_GT(FLAGS_queue_size, 0) << "--queue_size must be positive";
+  CHECK(FLAGS_short_side <= 0 || FLAGS_max_side <= 0)
+      << "--short_side and --max_side cannot be set at the same time";
 
-  bool is_color = !FLAGS_gray;
-  DatumVideoReader videoReader;
   std::ifstream infile(argv[2]);
-  std::vector<std::pair<string, int> > lines;
+  vector<pair<string, int> > lines;
   string filename;
   int label;
   while (infile >> filename >> label) {
@@ -71,124 +419,67 @@ int main(int argc, char** argv) {
   if (FLAGS_shuffle) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
+    if (FLAGS_seed >= 0) {
+      Caffe::set_random_seed(FLAGS_seed);
+    }
     shuffle(lines.begin(), lines.end());
   }
   LOG(INFO) << "A total of " << lines.size() << " videos.";
 
   const string& db_backend = FLAGS_backend;
-  const char* db_path = argv[3];
-
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
+  const string db_path(argv[3]);
+  const string root_folder(argv[1]);
 
-  // Open new db
-  // lmdb
-  MDB_env *mdb_env;
-  MDB_dbi mdb_dbi;
-  MDB_val mdb_key, mdb_data;
-  MDB_txn *mdb_txn;
-  // leveldb
-  leveldb::DB* db;
-  leveldb::Options options;
-  options.error_if_exists = true;
-  options.create_if_missing = true;
-  options.write_buffer_size = 268435456;
-  leveldb::WriteBatch* batch = NULL;
-
-  // Open db
-  if (db_backend == "leveldb") {  // leveldb
-    LOG(INFO) << "Opening leveldb " << db_path;
-    leveldb::Status status = leveldb::DB::Open(
-        options, db_path, &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << db_path
-        << ". Is it already existing?";
-    batch = new leveldb::WriteBatch();
-  } else if (db_backend == "lmdb") {  // lmdb
-    LOG(INFO) << "Opening lmdb " << db_path;
-    CHECK_EQ(mkdir(db_path, 0744), 0)
-        << "mkdir " << db_path << " failed";
-    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS)  // 1TB
-        << "mdb_env_set_mapsize failed";
-    CHECK_EQ(mdb_env_open(mdb_env, db_path, 0, 0664), MDB_SUCCESS)
-        << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
-        << "mdb_open failed. Does the lmdb already exist?";
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+  // Open the databases
+  vector<shared_ptr<EntryQueue> > queues;
+  vector<shared_ptr<DBWriter> > writers;
+  for (int shard = 0; shard < FLAGS_shards; ++shard) {
+    string shard_path = db_path;
+    if (FLAGS_shards > 1) {
+      std::ostringstream suffix;
+      suffix << "_" << shard;
+      shard_path += suffix.str();
+    }
+    queues.push_back(shared_ptr<EntryQueue>(
+        new EntryQueue(FLAGS_queue_size)));
+    writers.push_back(shared_ptr<DBWriter>(
+        new DBWriter(db_backend, shard_path, FLAGS_resume)));
   }
 
-  // Storing to db
-  string root_folder(argv[1]);
-  Datum datum;
-  int count = 0;
-  const int kMaxKeyLength = 256;
-  char key_cstr[kMaxKeyLength];
-  int data_size;
-
+  // Skip the videos that are already in one of the databases, whichever
+  // shard they ended up in.
+  std::set<string> done;
+  for (int shard = 0; shard < FLAGS_shards; ++shard) {
+    writers[shard]->ReadFilenames(&done);
+  }
+  vector<int> line_ids;
   for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    if (!videoReader.ReadVideoToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color, &datum)) {
-      continue;
-    }
-    data_size = datum.frames() * datum.channels() * datum.height() * datum.width();
-    const string& data = datum.data();
-    CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-          << data.size();
-    // sequential
-    snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
-        lines[line_id].first.c_str());
-    string value;
-    datum.SerializeToString(&value);
-    string keystr(key_cstr);
-
-    // Put in db
-    if (db_backend == "leveldb") {  // leveldb
-      batch->Put(keystr, value);
-    } else if (db_backend == "lmdb") {  // lmdb
-      mdb_data.mv_size = value.size();
-      mdb_data.mv_data = reinterpret_cast<void*>(&value[0]);
-      mdb_key.mv_size = keystr.size();
-      mdb_key.mv_data = reinterpret_cast<void*>(&keystr[0]);
-      CHECK_EQ(mdb_put(mdb_txn, mdb_dbi, &mdb_key, &mdb_data, 0), MDB_SUCCESS)
-          << "mdb_put failed";
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
+    if (!done.count(lines[line_id].first)) {
+      line_ids.push_back(line_id);
     }
+  }
+  if (FLAGS_resume) {
+    LOG(INFO) << done.size() << " videos are already converted, "
+              << line_ids.size() << " left.";
+  }
 
-    if (++count % 20 == 0) {
-      // Commit txn
-      if (db_backend == "leveldb") {  // leveldb
-        db->Write(leveldb::WriteOptions(), batch);
-        delete batch;
-        batch = new leveldb::WriteBatch();
-      } else if (db_backend == "lmdb") {  // lmdb
-        CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_commit failed";
-        CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_begin failed";
-      } else {
-        LOG(FATAL) << "Unknown db backend " << db_backend;
-      }
-      LOG(ERROR) << "Processed " << count << " files.";
-    }
+  // Storing to db
+  boost::thread_group writer_threads;
+  for (int shard = 0; shard < FLAGS_shards; ++shard) {
+    writer_threads.create_thread(boost::bind(&WriteVideos,
+        queues[shard].get(), writers[shard].get()));
   }
-  // write the last batch
-  if (count % 20 != 0) {
-    if (db_backend == "leveldb") {  // leveldb
-      db->Write(leveldb::WriteOptions(), batch);
-      delete batch;
-      delete db;
-    } else if (db_backend == "lmdb") {  // lmdb
-      CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
-      mdb_close(mdb_env, mdb_dbi);
-      mdb_env_close(mdb_env);
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
-    }
-    LOG(ERROR) << "Processed " << count << " files.";
+  LineDispenser dispenser(line_ids);
+  boost::thread_group decode_threads;
+  for (int i = 0; i < FLAGS_threads; ++i) {
+    decode_threads.create_thread(boost::bind(&DecodeVideos,
+        boost::cref(root_folder), boost::cref(lines), &dispenser,
+        boost::cref(queues)));
+  }
+  decode_threads.join_all();
+  for (int shard = 0; shard < FLAGS_shards; ++shard) {
+    queues[shard]->Push(NULL);
   }
+  writer_threads.join_all();
   return 0;
 }
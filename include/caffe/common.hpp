@@ -61,6 +61,8 @@ using std::string;
 using std::stringstream;
 using std::vector;
 
+class ThreadPool;
+
 // A global initialization function that you should call in your main function.
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
@@ -131,6 +133,11 @@ class Caffe {
   // added to allow larger batch_size
   inline static void set_accumulate(bool acum) {Get().accumulate_ = acum;}
   inline static bool accumulate() {return Get().accumulate_;}
+  // The threads that the CPU code of some layers splits its samples over.
+  // There is one by default; 0 asks for one per core.
+  static ThreadPool& thread_pool();
+  static void set_cpu_threads(const int num_threads);
+  inline static int cpu_threads() { return Get().cpu_threads_; }
 
  protected:
 #ifndef CPU_ONLY
@@ -144,6 +151,8 @@ class Caffe {
 
   Brew mode_;
   Phase phase_;
+  int cpu_threads_;
+  shared_ptr<ThreadPool> thread_pool_;
   static shared_ptr<Caffe> singleton_;
 
  private:
@@ -487,6 +487,51 @@ class SliceLayer : public Layer<Dtype> {
   vector<int> slice_point_;
 };
 
+/**
+ * @brief Averages each group of num_views consecutive items of its bottoms,
+ *        e.g. the scores of the views of a sample taken by a data layer in
+ *        TEST, into one item of the corresponding top.
+ *
+ * Each bottom is averaged into the top of the same index, so labels can be
+ * passed along with the scores.
+ */
+template <typename Dtype>
+class ViewAverageLayer : public Layer<Dtype> {
+ public:
+  explicit ViewAverageLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_VIEW_AVERAGE;
+  }
+  virtual inline int MinBottomBlobs() const { return 1; }
+  virtual inline bool EqualNumBottomTopBlobs() const { return true; }
+
+ protected:
+  /**
+   * @param bottom input Blob vector
+   *   -# @f$ (N V \times C \times H \times W) @f$
+   *      the inputs, V being num_views
+   * @param top output Blob vector, one per bottom
+   *   -# @f$ (N \times C \times H \times W) @f$
+   *      the averages of the V consecutive items of the inputs
+   */
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  int num_views_;
+};
+
 }  // namespace caffe
 
 #endif  // CAFFE_COMMON_LAYERS_HPP_
@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <list>
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -17,9 +19,13 @@
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/thread_pool.hpp"
+#include "caffe/util/blocking_queue.hpp"
 
 namespace caffe {
 
+class DatumVideoReader;
+
 #define HDF5_DATA_DATASET_NAME "data"
 #define HDF5_DATA_LABEL_NAME "label"
 
@@ -69,13 +75,52 @@ class BaseDataLayer : public Layer<Dtype> {
   bool output_labels_;
 };
 
+/**
+ * @brief The time the prefetch thread spent on a batch, by stage, and the
+ *        time Forward then waited for it. Stages a layer does not time are 0.
+ */
+struct BatchTimings {
+  BatchTimings()
+      : fetch_ms(0), parse_ms(0), transform_ms(0), load_ms(0), wait_ms(0) {}
+  float fetch_ms;      // reading the records or files
+  float parse_ms;      // parsing or decoding them into datums
+  float transform_ms;  // cropping, mirroring and scaling into the batch
+  float load_ms;       // all of the prefetch thread's work on the batch
+  float wait_ms;       // Forward blocked until the batch was loaded
+};
+
+/**
+ * @brief A batch of data and labels, filled by the prefetch thread of a
+ *        BasePrefetchingDataLayer.
+ */
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_;
+  BatchTimings timings_;
+#ifndef CPU_ONLY
+  // Recorded on the default stream when Forward releases the batch, so that
+  // the next asynchronous copy waits for the kernels still reading it.
+  cudaEvent_t release_event_;
+#endif
+};
+
+/**
+ * @brief Provides base for data layers that load their batches on a
+ *        persistent prefetch thread.
+ *
+ * The thread fills a ring of PREFETCH_COUNT batches: it takes batches from
+ * the free queue, loads them with LoadBatch and hands them to Forward through
+ * the full queue. Forward points the top blobs at the next full batch instead
+ * of copying it, and recycles the batch the tops pointed at before. Blobs
+ * sharing the data of the tops must therefore not be kept across Forward.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
-  explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
-  virtual ~BasePrefetchingDataLayer() {}
+  explicit BasePrefetchingDataLayer(const LayerParameter& param);
+  virtual ~BasePrefetchingDataLayer();
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
   // This method may not be overridden.
@@ -88,13 +133,38 @@ class BasePrefetchingDataLayer :
       vector<Blob<Dtype>*>* top);
 
   virtual void CreatePrefetchThread();
-  virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+  virtual void StopPrefetchThread();
+
+  // Whether to keep the timings of the batches Forward passes on, for the
+  // solver to report.
+  void set_record_timings(const bool record) { record_timings_ = record; }
+  // Moves the timings kept since the last call to the end of timings.
+  void TakeTimings(vector<BatchTimings>* timings);
+
+  static const int PREFETCH_COUNT = 3;
 
  protected:
-  Blob<Dtype> prefetch_data_;
-  Blob<Dtype> prefetch_label_;
+  // The thread's function: loads batches until the thread is stopped.
+  virtual void InternalThreadEntry();
+  // Fills the data, and the labels if output_labels_, of one batch.
+  virtual void LoadBatch(Batch<Dtype>* batch) = 0;
+  // Points the top blobs at the next full batch.
+  void NextBatch(vector<Blob<Dtype>*>* top);
+
+  Batch<Dtype> prefetch_[PREFETCH_COUNT];
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // The batch the top blobs point at, returned to prefetch_free_ by the next
+  // Forward.
+  Batch<Dtype>* current_batch_;
+  // Whether the prefetch thread also copies each batch to device_, on its own
+  // stream, so that Forward_gpu finds it there.
+  bool async_copy_;
+  int device_;
+  // Whether the release events of the batches have been created.
+  bool release_events_;
+  bool record_timings_;
+  vector<BatchTimings> timings_;
 };
 
 template <typename Dtype>
@@ -113,8 +183,46 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline int MaxTopBlobs() const { return 2; }
 
+  virtual void CreatePrefetchThread();
+
  protected:
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  // Transforms the items of batch_datums_ assigned to one worker.
+  void TransformItems(const int worker_id, Dtype* top_data);
+  // Key index, used for shuffled or sharded LMDB reads
+  void ShuffleKeys();
+  void SeekKey();
+  void NextKey();
+
+  // A datum kept in the cache: its other fields, and its uint8 data.
+  struct CacheEntry {
+    Datum header;
+    string data;
+    size_t size;  // the bytes counted against the budget
+    std::list<string>::iterator lru_pos;
+  };
+  // Points item_id of the batch being loaded at the cached datum of key, if
+  // any.
+  bool ReadCachedItem(const string& key, const int item_id);
+  // Moves the datum of item_id into the cache, if the budget allows it, and
+  // points the item at the cached copy.
+  void CacheItem(const string& key, const int item_id);
+
+  // The datums of the batch being loaded, read sequentially from the db, one
+  // per views_per_sample items. With LMDB only their headers are parsed, and
+  // their data is read in place.
+  vector<Datum> batch_datums_;
+  vector<const char*> batch_data_;
+  vector<int> batch_data_sizes_;
+  // The cache entries the items point at, kept alive should they be evicted
+  // before the batch is transformed.
+  vector<shared_ptr<CacheEntry> > batch_cache_entries_;
+  // The transformers of the workers past the first, which uses
+  // data_transformer_.
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  // The transform workers, kept across batches; the prefetch thread is the
+  // first one.
+  shared_ptr<ThreadPool> transform_pool_;
 
   // LEVELDB
   shared_ptr<leveldb::DB> db_;
@@ -125,6 +233,17 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   MDB_txn* mdb_txn_;
   MDB_cursor* mdb_cursor_;
   MDB_val mdb_key_, mdb_value_;
+  // The keys read by this layer, in reading order; empty when the cursor is
+  // walked sequentially.
+  vector<string> keys_;
+  int key_id_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // The cache, by key, see DataParameter.cache_bytes. cache_lru_ holds the
+  // keys, the most recently read first.
+  std::map<string, shared_ptr<CacheEntry> > cache_;
+  std::list<string> cache_lru_;
+  size_t cache_size_;
+  bool cache_full_;
 };
 
 /**
@@ -268,7 +387,7 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
@@ -315,6 +434,70 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
   bool has_new_data_;
 };
 
+/**
+ * @brief Provides data to the Net from video files listed in a "path label"
+ *        source file.
+ *
+ * Instead of decoding whole clips, the layer samples a temporal window of
+ * transform_param.video_crop_size_t frames per clip (random offset and step in
+ * TRAIN, centered in TEST) and decodes only that window with
+ * DatumVideoReader::ReadVideoWindow. The videos of a batch are decoded by
+ * video_data_param.decode_threads threads, each with its own reader; the
+ * spatial crop, mirror and mean are then applied by the DataTransformer video
+ * path. All random numbers are drawn on the prefetch thread, so the batches do
+ * not depend on how the decoding is scheduled.
+ *
+ * TODO(dox): thorough documentation for Forward and proto params.
+ */
+template <typename Dtype>
+class VideoDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit VideoDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param) {}
+  virtual ~VideoDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_VIDEO_DATA;
+  }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int ExactNumTopBlobs() const { return 2; }
+
+ protected:
+  virtual unsigned int PrefetchRand();
+  virtual void ShuffleVideos();
+  // Moves batch item item_id to the next line of the list and draws the
+  // random numbers its window will be sampled from.
+  virtual void NextBatchLine(const int item_id);
+  // Picks the first frame and the frame step of the window to decode from a
+  // clip of the given length, using two pre-drawn random numbers.
+  virtual void SampleWindow(const int frames, const unsigned int rand_step,
+      const unsigned int rand_offset, int* start_frame, int* step);
+  // Decodes the sampled window of batch item item_id with the given reader.
+  virtual bool ReadVideoWindow(const int item_id, DatumVideoReader* reader);
+  // Decodes the batch items assigned to one decode thread.
+  virtual void DecodeVideos(const int thread_id);
+  virtual void LoadBatch(Batch<Dtype>* batch);
+
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // one reader per decode thread; the prefetch thread is the first one
+  vector<shared_ptr<DatumVideoReader> > readers_;
+  shared_ptr<ThreadPool> decode_pool_;
+  vector<std::pair<std::string, int> > lines_;
+  // frame count of each video, filled in the first time it is opened
+  std::map<std::string, int> frame_counts_;
+  int lines_id_;
+  // per batch item: (filename, label), random numbers, frame count and
+  // decoded datum. The line is copied, since a reshuffle of lines_ can happen
+  // partway through a batch.
+  vector<std::pair<std::string, int> > batch_lines_;
+  vector<unsigned int> batch_rands_;
+  vector<int> batch_frames_;
+  vector<int> batch_ok_;
+  vector<Datum> batch_datums_;
+};
+
 /**
  * @brief Provides data to the Net from windows of images files, specified
  *        by a window data file.
@@ -338,7 +521,7 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
@@ -1,6 +1,9 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <algorithm>
+#include <string>
+
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 
@@ -14,13 +17,32 @@ template <typename Dtype>
 class DataTransformer {
  public:
   explicit DataTransformer(const TransformationParameter& param)
-    : param_(param) {
+    : param_(param), mean_frames_(1), mean_size_(0), channel_mean_(false) {
     phase_ = Caffe::phase();
   }
   virtual ~DataTransformer() {}
 
   void InitRand();
 
+  /**
+   * @brief Sets the phase the transformations are made in, which is
+   * Caffe::phase() at construction. Data layers update it when they start
+   * their prefetch thread, since a net may be built in another phase than it
+   * runs in. Call InitRand after it.
+   */
+  void set_phase(const Caffe::Phase phase) { phase_ = phase; }
+
+  /**
+   * @brief Sets the shape of the mean passed to Transform. By default the
+   * mean holds one value per pixel of the datum.
+   *
+   * A height and width of 1 hold one value per channel, which is subtracted
+   * without reading a full mean image. A num greater than 1 holds one mean
+   * per temporal position of a video crop; positions past num use the last.
+   */
+  void SetMeanShape(const int num, const int channels, const int height,
+                    const int width);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to the data.
@@ -36,10 +58,43 @@ class DataTransformer {
    *    written at the appropriate place within the blob's data.
    */
   void Transform(const int batch_item_id, const Datum& datum,
-                 const Dtype* mean, Dtype* transformed_data);
+                 const Dtype* mean, Dtype* transformed_data) {
+    Transform(batch_item_id, datum, datum.data().data(), datum.data().size(),
+              mean, transformed_data);
+  }
+
+  /**
+   * @brief As above, but the uint8 data is read from data_size bytes at data
+   * instead of datum.data(). This lets data layers transform the data in
+   * place in a database, with the other fields of datum parsed by
+   * ParseDatumHeader.
+   *
+   * @param view_id
+   *    Which of the views_per_sample() views of the datum this is. In TEST, it
+   *    selects the temporal offset, the spatial crop and the mirroring of the
+   *    view.
+   */
+  void Transform(const int batch_item_id, const Datum& datum,
+                 const char* data, const int data_size,
+                 const Dtype* mean, Dtype* transformed_data,
+                 const int view_id = 0);
+
+  /**
+   * @brief The number of views data layers should take from each datum:
+   * clips_per_sample, times test_crops, times 2 with test_mirror in TEST.
+   */
+  int views_per_sample() const;
 
  protected:
   virtual unsigned int Rand();
+  // The offsets of spatial crop crop_id of the test_crops crops.
+  void TestCropOffsets(const int crop_id, const int height, const int width,
+      const int crop_height, const int crop_width, int* h_off,
+      int* w_off) const;
+  // The mean of temporal position f of a video crop.
+  const Dtype* FrameMean(const Dtype* mean, const int f) const {
+    return mean + std::min(f, mean_frames_ - 1) * mean_size_;
+  }
 
   // Tranformation parameters
   TransformationParameter param_;
@@ -47,6 +102,12 @@ class DataTransformer {
 
   shared_ptr<Caffe::RNG> rng_;
   Caffe::Phase phase_;
+  // the sampled frames of a video datum with encoded frames
+  string video_buffer_;
+  // shape of the mean, see SetMeanShape
+  int mean_frames_;
+  int mean_size_;
+  bool channel_mean_;
 };
 
 }  // namespace caffe
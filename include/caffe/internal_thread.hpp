@@ -15,6 +15,7 @@ class Thread {
   Thread(Callable func, A1 a1);
   void join();
   bool joinable();
+  void interrupt();
  private:
   void* thread_;
 };
@@ -35,6 +36,13 @@ class InternalThread {
   /** Will not return until the internal thread has exited. */
   bool WaitForInternalThreadToExit();
 
+  /**
+   * Asks the internal thread to stop, and waits until it has exited. Threads
+   * that loop should check must_stop(); waiting on boost primitives is
+   * interrupted as well.
+   */
+  bool StopInternalThread();
+
   bool is_started() const { return thread_ != NULL && thread_->joinable(); }
 
  protected:
@@ -42,6 +50,10 @@ class InternalThread {
       with the code you want your thread to run. */
   virtual void InternalThreadEntry() {}
 
+  /* Should be called from the internal thread: true once it was asked to stop
+      by StopInternalThread. */
+  bool must_stop();
+
   caffe::Thread* thread_;
 };
 
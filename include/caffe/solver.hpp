@@ -53,6 +53,9 @@ class Solver {
   void Restore(const char* resume_file);
   virtual void RestoreSolverState(const SolverState& state) = 0;
   void DisplayOutputBlobs(const int net_id);
+  // Logs the timings of the batches the data layers of the train net passed on
+  // since the last call, elapsed_ms being the training time since then.
+  void DisplayInputTimings(const float elapsed_ms);
 
   SolverParameter param_;
   int iter_;
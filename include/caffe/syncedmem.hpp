@@ -8,28 +8,23 @@
 
 namespace caffe {
 
-// Theoretically, CaffeMallocHost and CaffeFreeHost should simply call the
-// cudaMallocHost and cudaFree functions in order to create pinned memory.
-// However, those codes rely on the existence of a cuda GPU (I don't know
-// why that is a must since allocating memory should not be accessing the
-// GPU resorce, but it just creates an error as of Cuda 5.0) and will cause
-// problem when running on a machine without GPU. Thus, we simply define
-// these two functions for safety and possible future change if the problem
-// of calling cuda functions disappears in a future version.
-//
-// In practice, although we are creating unpinned memory here, as long as we
-// are constantly accessing them the memory pages almost always stays in
-// the physical memory (assuming we have large enough memory installed), and
-// does not seem to create a memory bottleneck here.
-
-inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
-}
-
-inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
-}
+// The kinds of host memory CaffeMallocHost can allocate. The values match
+// PrefetchParameter.HostMemory.
+// - HOST_PAGEABLE: plain malloc, the default.
+// - HOST_PINNED: page-locked memory from cudaMallocHost, which the device
+//   can copy from asynchronously. cudaMallocHost fails on machines without
+//   a GPU, so it is only tried in GPU mode, and HOST_PAGEABLE is used instead
+//   otherwise.
+// - HOST_LOCKED: page aligned memory locked with mlock, so that it is never
+//   paged out, and backed by huge pages where the kernel supports it. Used in
+//   CPU_ONLY builds, or where pinning is not wanted.
+// The allocation falls back to HOST_PAGEABLE when the kind requested is not
+// available, and *memory is updated to the kind actually allocated, which
+// CaffeFreeHost must be given.
+enum HostMemory { HOST_PAGEABLE = 0, HOST_PINNED = 1, HOST_LOCKED = 2 };
 
+void CaffeMallocHost(void** ptr, size_t size, HostMemory* memory);
+void CaffeFreeHost(void* ptr, size_t size, HostMemory memory);
 
 /**
  * @brief Manages memory allocation and synchronization between the host (CPU)
@@ -41,10 +36,10 @@ class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), host_memory_(HOST_PAGEABLE) {}
   explicit SyncedMemory(size_t size)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), host_memory_(HOST_PAGEABLE) {}
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
@@ -54,6 +49,15 @@ class SyncedMemory {
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  // Selects the kind of host memory allocated, before it is allocated.
+  void set_host_memory(HostMemory memory);
+  HostMemory host_memory() const { return host_memory_; }
+
+#ifndef CPU_ONLY
+  // Starts copying the host data to the device on stream. The caller must
+  // synchronize stream before the device data is used.
+  void async_gpu_push(const cudaStream_t& stream);
+#endif
 
  private:
   void to_cpu();
@@ -63,6 +67,7 @@ class SyncedMemory {
   size_t size_;
   SyncedHead head_;
   bool own_cpu_data_;
+  HostMemory host_memory_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -35,6 +35,23 @@ class Timer {
   float elapsed_milliseconds_;
 };
 
+// Measures wall time on the host whatever the mode, and with microsecond
+// resolution. Unlike Timer, it does not use the device, so it can time the
+// work of the prefetch threads.
+class CPUTimer {
+ public:
+  CPUTimer() : running_(false) {}
+  void Start();
+  void Stop();
+  // The time between the last Start and Stop; a running timer is stopped.
+  float MilliSeconds();
+
+ protected:
+  bool running_;
+  boost::posix_time::ptime start_cpu_;
+  boost::posix_time::ptime stop_cpu_;
+};
+
 }  // namespace caffe
 
 #endif   // CAFFE_UTIL_BENCHMARK_H_
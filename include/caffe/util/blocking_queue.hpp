@@ -0,0 +1,38 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * A queue shared by threads, whose pop waits until an element is pushed.
+ * The boost synchronization primitives are defined in blocking_queue.cpp to
+ * force host compilation for boost, as in caffe/util/thread.hpp.
+ * Waiting in pop is an interruption point of boost::thread.
+ */
+template<typename T>
+class BlockingQueue {
+ public:
+  BlockingQueue();
+
+  void push(const T& t);
+  // Returns false instead of waiting if the queue is empty.
+  bool try_pop(T* t);
+  T pop();
+  size_t size() const;
+
+ protected:
+  class sync;
+
+  std::queue<T> queue_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
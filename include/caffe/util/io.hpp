@@ -102,6 +102,13 @@ inline bool ReadImageToDatum(const string& filename, const int label,
   return ReadImageToDatum(filename, label, 0, 0, datum);
 }
 
+// Parses a serialized Datum without copying its data field: every other field
+// is parsed into header, and data and data_size are set to the bytes of the
+// data field inside buffer, which must outlive them. data is NULL if the Datum
+// has no data field.
+bool ParseDatumHeader(const void* buffer, const int size, Datum* header,
+    const char** data, int* data_size);
+
 leveldb::Options GetLevelDBOptions();
 
 template <typename Dtype>
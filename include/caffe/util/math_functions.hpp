@@ -20,6 +20,14 @@ void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// The same with explicit leading dimensions, for sub-blocks of larger
+// row-major matrices.
+template <typename Dtype>
+void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int lda, const Dtype* B,
+    const int ldb, const Dtype beta, Dtype* C, const int ldc);
+
 template <typename Dtype>
 void caffe_cpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -165,6 +173,16 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// Converts a row of n bytes, subtracts a mean and scales:
+//   y[i] = (x[i] - mean[i * mean_step]) * scale,
+// where mean_step is 1 for a row of means or 0 for a single mean. If reverse,
+// the row is written right to left, i.e. to y[n - 1 - i]. The float version
+// is vectorized with SSE2, or AVX2 when built with -mavx2.
+template <typename Dtype>
+void caffe_cpu_uint8_sub_scale(const int n, const uint8_t* x,
+    const Dtype* mean, const int mean_step, const Dtype scale,
+    const bool reverse, Dtype* y);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
@@ -176,6 +194,12 @@ void caffe_gpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+template <typename Dtype>
+void caffe_gpu_gemm(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int lda, const Dtype* B,
+    const int ldb, const Dtype beta, Dtype* C, const int ldc);
+
 template <typename Dtype>
 void caffe_gpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -0,0 +1,48 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * A fixed set of threads that run one task at a time, all together.
+ * Run calls the task once with each thread id 0 ... num_threads() - 1 and
+ * returns once every call is done. The calling thread takes id 0, so a pool
+ * of one thread runs the task inline without any synchronization.
+ * The boost synchronization primitives are defined in thread_pool.cpp to
+ * force host compilation for boost, as in caffe/util/blocking_queue.hpp.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int num_threads() const { return num_threads_; }
+  // Tasks from concurrent callers run one after the other.
+  void Run(const boost::function<void(int)>& task);
+
+ protected:
+  class sync;
+
+  void WorkerEntry(int thread_id);
+
+  int num_threads_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+// The share [*begin, *end) of count items that thread_id of num_threads
+// takes in a ThreadPool task, in contiguous blocks of nearly equal size.
+inline void ThreadRange(const int count, const int thread_id,
+    const int num_threads, int* begin, int* end) {
+  *begin = static_cast<int64_t>(count) * thread_id / num_threads;
+  *end = static_cast<int64_t>(count) * (thread_id + 1) / num_threads;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
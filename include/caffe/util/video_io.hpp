@@ -6,30 +6,152 @@
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <stdint.h>
 #include <unistd.h>
 #include <string>
+#include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 namespace caffe {
 
+// Microseconds a DatumVideoReader spent in each stage of reading videos,
+// summed over the videos read while it was attached with set_stage_timings.
+struct VideoStageTimings {
+  VideoStageTimings()
+      : open_us(0), decode_us(0), resize_us(0), pack_us(0), frames(0) {}
+  int64_t open_us;    // opening the file and querying its properties
+  int64_t decode_us;  // grabbing and retrieving the frames
+  int64_t resize_us;  // cv::resize to the requested size
+  int64_t pack_us;    // color conversion and deinterleaving into the datum
+  int64_t frames;
+};
+
+/**
+ * @brief Decodes a video file into a Datum of frames x channels x height x
+ *        width uint8 values.
+ *
+ * The Datum payload is sized once from CV_CAP_PROP_FRAME_COUNT and every
+ * decoded frame is deinterleaved (HWC -> CHW) straight into its slot, so a
+ * reader can be reused across videos without reallocating its scratch
+ * buffers.
+ */
 class DatumVideoReader{
 public:
+  // How frames are resized: to the height and width passed to the read
+  // methods, or so that their shorter or longer side is set_resize_mode's
+  // side pixels long, preserving their aspect ratio.
+  enum ResizeMode { RESIZE_EXACT, RESIZE_SHORT_SIDE, RESIZE_MAX_SIDE };
+
+  DatumVideoReader()
+      : resize_mode_(RESIZE_EXACT), resize_side_(0), interpolation_(-1),
+        timings_(NULL) {}
   bool ReadVideoToDatum(const string& filename, const int label,
        const int height, const int width, const bool is_color, Datum* datum);
   inline bool ReadVideoToDatum(const string& filename, const int label,
-       const int height, const int width, Datum* datum);
+       const int height, const int width, Datum* datum) {
+    return ReadVideoToDatum(filename, label, height, width, true, datum);
+  }
   inline bool ReadVideoToDatum(const string& filename, const int label,
-       Datum* datum);
+       Datum* datum) {
+    return ReadVideoToDatum(filename, label, 0, 0, true, datum);
+  }
+  // Resamples the clip to fps frames per second by dropping frames at decode
+  // time, and keeps at most its first max_frames frames. The source rate is
+  // kept if fps is not positive or above it, and every frame is kept if
+  // max_frames is not positive.
+  bool ReadVideoToDatum(const string& filename, const int label,
+       const int height, const int width, const bool is_color, const float fps,
+       const int max_frames, Datum* datum);
+  // Decodes num_frames frames, taking every step-th frame starting at
+  // start_frame. The reader seeks to start_frame with CV_CAP_PROP_POS_FRAMES
+  // instead of decoding the clip from its beginning, and only grabs (without
+  // retrieving) the frames it skips. A non-positive num_frames reads to the
+  // end of the clip; fewer frames are returned if the clip ends early.
+  bool ReadVideoWindow(const string& filename, const int label,
+       const int start_frame, const int num_frames, const int step,
+       const int height, const int width, const bool is_color, Datum* datum);
+  inline bool ReadVideoWindow(const string& filename, const int label,
+       const int start_frame, const int num_frames, const int step,
+       Datum* datum) {
+    return ReadVideoWindow(filename, label, start_frame, num_frames, step,
+                           0, 0, true, datum);
+  }
+  // Returns the frame count reported by the container (0 if unknown), or -1
+  // if the file cannot be opened.
+  int CountFrames(const string& filename);
+  // In the RESIZE_SHORT_SIDE and RESIZE_MAX_SIDE modes, the height and width
+  // passed to the read methods are ignored.
+  void set_resize_mode(const ResizeMode mode, const int side) {
+    CHECK(mode == RESIZE_EXACT || side > 0) << "The resize side must be set";
+    resize_mode_ = mode;
+    resize_side_ = side;
+  }
+  // Sets the cv::resize interpolation. By default, or if interpolation is
+  // negative, INTER_AREA is used to shrink frames and INTER_LINEAR to enlarge
+  // them.
+  void set_interpolation(const int interpolation) {
+    interpolation_ = interpolation;
+  }
+  // Accumulates the time of every stage into timings, or stops timing if
+  // timings is NULL.
+  void set_stage_timings(VideoStageTimings* timings) { timings_ = timings; }
   // added by sxyu
   ~DatumVideoReader();
 private:
+  // Adds the time since the end of the previous stage to the given field of
+  // timings_, if set.
+  void EndStage(int64_t VideoStageTimings::* stage) {
+    if (timings_) {
+      const boost::posix_time::ptime now =
+          boost::posix_time::microsec_clock::local_time();
+      timings_->*stage += (now - stage_start_).total_microseconds();
+      stage_start_ = now;
+    }
+  }
+
+  // ReadVideoWindow, with step further multiplied by the ratio of the source
+  // frame rate to fps when fps is positive and lower.
+  bool ReadFrames(const string& filename, const int label,
+       const int start_frame, const int num_frames, const int step,
+       const float fps, const int height, const int width, const bool is_color,
+       Datum* datum);
+  // The size frames of source_height x source_width are resized to, given
+  // the requested height and width and the resize mode.
+  cv::Size ResizedSize(const int source_height, const int source_width,
+       const int height, const int width) const;
+  // Writes img as channels planes of height x width bytes starting at dst.
+  void CopyFrameToBuffer(const cv::Mat& img, const bool is_color, char* dst);
+
+  ResizeMode resize_mode_;
+  int resize_side_;
+  int interpolation_;
+  // Scratch buffers, reused across frames and videos: OpenCV only
+  // reallocates them when the frame size changes.
   cv::Mat frame;
   cv::Mat img;  // after resize
+  cv::Mat gray;  // after color conversion
+  std::vector<cv::Mat> planes;  // views into the datum buffer
   cv::VideoCapture reader;
+  VideoStageTimings* timings_;
+  boost::posix_time::ptime stage_start_;
 };
 
+// Replaces the raw frames of a video datum by one encoded image per frame in
+// encoded_frames. format is the image extension, e.g. "jpg" or "png".
+bool EncodeVideoDatum(const string& format, Datum* datum);
+
+// Decodes the frames frame_ids of a video datum with encoded frames, spreading
+// them over num_threads threads, which are kept for the next calls from the
+// same thread. The i-th frame is written as channels x height x width bytes at
+// dst + i * channels * height * width; negative ids are skipped.
+bool DecodeVideoFrames(const Datum& datum, const std::vector<int>& frame_ids,
+    const int num_threads, char* dst);
+
+// Decodes every encoded frame of a video datum back into data.
+bool DecodeVideoDatum(Datum* datum);
 
 }  // namespace caffe
 
@@ -1,6 +1,7 @@
 #ifndef CAFFE_VISION_LAYERS_HPP_
 #define CAFFE_VISION_LAYERS_HPP_
 
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
@@ -305,6 +306,17 @@ class RecursiveOnceLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 
+  /// The CPU passes over the samples that thread_id of the CPU thread pool
+  /// takes, with its own slices of tmp_buffer_ and of the parameter
+  /// gradients. The diffs that are not needed are NULL.
+  void ForwardSamples_cpu(const Dtype* bottom_data,
+      const Dtype* weight_buf_data, Dtype* top_data, int* mask,
+      Dtype* out_data, const int thread_id);
+  void BackwardSamples_cpu(const Dtype* top_diff, const int* mask,
+      const Dtype* bottom_data, Dtype* bottom_diff, Dtype* weight_buf_diff,
+      Dtype* bias_diff, Dtype* tmp_diff, const int thread_id);
+  void ReshapeThreadBuffers();
+
   int num_;
   int channels_;
   int height_, width_;
@@ -333,7 +345,11 @@ class RecursiveOnceLayer : public Layer<Dtype> {
   int N_;
   Blob<Dtype> weight_buffer_;
   Blob<int> max_idx_;
+  /// One slice per thread of the CPU pool.
+  int buffer_threads_;
   Blob<Dtype> tmp_buffer_;
+  Blob<Dtype> thread_weight_diff_;
+  Blob<Dtype> thread_bias_diff_;
   Blob<Dtype> bias_multiplier_;
 };
 
@@ -392,6 +408,28 @@ class TemporalConvolutionLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 
+  /// The CPU passes over the samples that thread_id of the CPU thread pool
+  /// takes, with its own slices of the scratch buffers. Maps of at most
+  /// batched_gemm_max_size pixels run all windows of a sample in one GEMM.
+  /// The diffs that are not needed are NULL.
+  void ForwardSamples_cpu(const Dtype* bottom_data, const Dtype* weight,
+      Dtype* top_data, Dtype* col, Dtype* top_buffer, const int thread_id);
+  void BackwardSamples_cpu(const Dtype* top_diff, const Dtype* bottom_data,
+      Dtype* bottom_diff, Dtype* weight_diff, Dtype* col, Dtype* col_diff,
+      Dtype* top_buffer_diff, const int thread_id);
+  void ReshapeThreadBuffers();
+  /// Unrolls the windows of a sample into the columns of col, and adds such
+  /// columns back onto the frames they were taken from.
+  void BuildWindowColumns(const Dtype* bottom_data, Dtype* col);
+  void AccumulateWindowColumns(const Dtype* col, Dtype* bottom_diff);
+  /// The taps [*first, *last) of window g that fall inside the input; the
+  /// others fall into the zero padding and are skipped.
+  inline void ValidTaps(const int g, int* first, int* last) const {
+    const int start = g * stride_ - pad_;
+    *first = std::max(0, -start);
+    *last = std::min(kernel_size_, group_ - start);
+  }
+
   int num_;
   int channels_;
   int height_, width_;
@@ -415,7 +453,17 @@ class TemporalConvolutionLayer : public Layer<Dtype> {
   /// dimensions of the data and filter matrices.
   int N_;
   Blob<Dtype> bias_multiplier_;
-  Blob<Dtype> padded_bottom_i_;
+  /// The bias broadcast over a window (M_ x N_), and the ones over all
+  /// num_ x group_out_ windows that broadcast it to the whole top.
+  Blob<Dtype> bias_plane_;
+  Blob<Dtype> window_multiplier_;
+  bool batched_gemm_;
+  Blob<Dtype> weight_bias_;
+  /// One slice per thread of the CPU pool.
+  int buffer_threads_;
+  Blob<Dtype> col_buffer_;
+  Blob<Dtype> top_buffer_;
+  Blob<Dtype> thread_weight_diff_;
 };
 
 
@@ -458,9 +506,29 @@ class TemporalPoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
 
+  /// The max pooling over the samples that thread_id of the CPU thread pool
+  /// takes.
+  void ForwardMax_cpu(const Dtype* bottom_data, Dtype* top_data, int* mask,
+      Dtype* block_max, int* block_max_idx, const int thread_id);
+  void BackwardMax_cpu(const Dtype* top_diff, const int* mask,
+      Dtype* bottom_diff, const int thread_id);
+  /// The max pooling of one sample when the windows overlap, in time
+  /// independent of kernel_size_.
+  void SlidingMax_cpu(const Dtype* bottom_data, Dtype* top_data, int* mask,
+      Dtype* block_max, int* block_max_idx);
+  /// The average pooling over the samples that thread_id takes; running_sum
+  /// is NULL unless the windows overlap.
+  void ForwardAve_cpu(const Dtype* bottom_data, Dtype* top_data,
+      Dtype* running_sum, const int thread_id);
+  void BackwardAve_cpu(const Dtype* top_diff, Dtype* bottom_diff,
+      Dtype* running_sum, const int thread_id);
+  void ReshapeThreadBuffers();
+  inline void Window(const int g, int* start, int* end, int* pool_size) const;
+
   //int kernel_h_, kernel_w_;
   //int stride_h_, stride_w_;
   //int pad_h_, pad_w_;
+  int num_;
   int kernel_size_;
   int stride_;
   int pad_;
@@ -472,7 +540,18 @@ class TemporalPoolingLayer : public Layer<Dtype> {
   int pooled_length_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
+  /// Whether the last CPU Forward filled max_idx_, which it skips in TEST.
+  /// Backward then pools again into mask_top_ to fill it.
+  bool max_idx_valid_;
+  Blob<Dtype> mask_top_;
   int K_;
+  /// The prefix and suffix block maxima of SlidingMax_cpu and their frames,
+  /// and the running sums of the AVE pooling, one slice per thread of the
+  /// CPU pool.
+  int buffer_threads_;
+  Blob<Dtype> block_max_;
+  Blob<int> block_max_idx_;
+  Blob<Dtype> running_sum_;
 };
 
 
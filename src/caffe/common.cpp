@@ -1,9 +1,13 @@
+#include <boost/thread.hpp>
 #include <glog/logging.h>
+
+#include <algorithm>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -37,10 +41,28 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InitGoogleLogging(*(pargv)[0]);
 }
 
+ThreadPool& Caffe::thread_pool() {
+  if (!Get().thread_pool_) {
+    Get().thread_pool_.reset(new ThreadPool(Get().cpu_threads_));
+  }
+  return *(Get().thread_pool_);
+}
+
+void Caffe::set_cpu_threads(const int num_threads) {
+  CHECK_GE(num_threads, 0);
+  const int threads = num_threads > 0 ? num_threads :
+      std::max<int>(boost::thread::hardware_concurrency(), 1);
+  if (threads != Get().cpu_threads_) {
+    Get().cpu_threads_ = threads;
+    Get().thread_pool_.reset();
+  }
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
-    : random_generator_(), mode_(Caffe::CPU), phase_(Caffe::TRAIN) { }
+    : random_generator_(), mode_(Caffe::CPU), phase_(Caffe::TRAIN),
+    cpu_threads_(1) { }
 
 Caffe::~Caffe() { }
 
@@ -84,7 +106,7 @@ void* Caffe::RNG::generator() {
 
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU), phase_(Caffe::TRAIN) {
+    mode_(Caffe::CPU), phase_(Caffe::TRAIN), cpu_threads_(1) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
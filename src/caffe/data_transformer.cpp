@@ -1,17 +1,22 @@
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "caffe/data_transformer.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/video_io.hpp"
 
 namespace caffe {
 
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const int batch_item_id,
                                        const Datum& datum,
+                                       const char* data,
+                                       const int data_size,
                                        const Dtype* mean,
-                                       Dtype* transformed_data) {
-  const string& data = datum.data();
+                                       Dtype* transformed_data,
+                                       const int view_id) {
   const int frames = datum.frames();
   const int channels = datum.channels();
   const int height = datum.height();
@@ -24,7 +29,20 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
 
   const bool is_video = param_.is_video();
 
+  // In TEST, a view is a temporal clip, a spatial crop and a mirroring.
+  int clip_id = view_id;
+  int crop_id = 0;
+  bool mirror_view = false;
+  if (phase_ != Caffe::TRAIN) {
+    const int mirrors = param_.test_mirror() ? 2 : 1;
+    clip_id = view_id / (mirrors * param_.test_crops());
+    crop_id = view_id / mirrors % param_.test_crops();
+    mirror_view = view_id % mirrors;
+  }
+
   if (!is_video) {
+    CHECK(!channel_mean_ || (height == 1 && width == 1))
+        << "Per-channel means are only supported for videos";
 
     if (mirror && crop_size == 0) {
       LOG(FATAL) << "Current implementation requires mirror and crop_size to be "
@@ -32,17 +50,19 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
     }
 
     if (crop_size) {
-      CHECK(data.size()) << "Image cropping only support uint8 data";
+      CHECK(data_size) << "Image cropping only support uint8 data";
       int h_off, w_off;
       // We only do random crop when we do training.
       if (phase_ == Caffe::TRAIN) {
         h_off = Rand() % (height - crop_size);
         w_off = Rand() % (width - crop_size);
       } else {
-        h_off = (height - crop_size) / 2;
-        w_off = (width - crop_size) / 2;
+        TestCropOffsets(crop_id, height, width, crop_size, crop_size, &h_off,
+                        &w_off);
       }
-      if (mirror && Rand() % 2) {
+      const bool do_mirror = (phase_ == Caffe::TRAIN) ?
+          mirror && Rand() % 2 : mirror_view;
+      if (do_mirror) {
         // Copy mirrored version
         for (int c = 0; c < channels; ++c) {
           for (int h = 0; h < crop_size; ++h) {
@@ -75,7 +95,7 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
       }
     } else {
       // we will prefer to use data() first, and then try float_data()
-      if (data.size()) {
+      if (data_size) {
         for (int j = 0; j < size; ++j) {
           Dtype datum_element =
               static_cast<Dtype>(static_cast<uint8_t>(data[j]));
@@ -128,96 +148,118 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
     } else if(v_step > video_step_max) {
       v_step = video_step_max;
     }
-    if(v_step >= 2) {
+    // We only do random temporal crop when we do training.
+    if(v_step >= 2 && phase_ == Caffe::TRAIN) {
       v_step = Rand() % v_step + 1;
     }
 
     if(need_pad) {
       left_index = (crop_frames - frames) / 2;
-      right_index = left_index + crop_frames - 1;
+      right_index = left_index + frames - 1;
       f_off = - left_index;
-    } else {
+    } else if (phase_ == Caffe::TRAIN) {
       f_off = Rand() % (frames - crop_frames * v_step + v_step);
+    } else if (param_.clips_per_sample() > 1) {
+      // the first clip starts at the first frame and the last ends at the last
+      f_off = clip_id * (frames - (crop_frames - 1) * v_step - 1)
+          / (static_cast<int>(param_.clips_per_sample()) - 1);
+    } else {
+      f_off = (frames - (crop_frames - 1) * v_step - 1) / 2;
     }
 
-    // memset transformed data
-    int video_size = crop_frames * channels * crop_height * crop_width;
-    caffe_set(video_size, Dtype(0), 
-              transformed_data + (batch_item_id * video_size));
+    // Frame f of the crop is frame frame_off + f * frame_step of video_data.
+    const char* video_data = data;
+    bool uint8_data = data_size > 0;
+    int frame_off = f_off;
+    int frame_step = v_step;
+    if (datum.encoded_frames_size() > 0) {
+      // Only decode the sampled frames, in crop order.
+      std::vector<int> frame_ids(crop_frames, -1);
+      for (int f = 0; f < crop_frames; ++f) {
+        if (!need_pad || (f >= left_index && f <= right_index)) {
+          frame_ids[f] = f_off + f * v_step;
+        }
+      }
+      video_buffer_.resize(crop_frames * size);
+      CHECK(DecodeVideoFrames(datum, frame_ids, param_.video_decode_threads(),
+                              &video_buffer_[0]))
+          << "Could not decode the frames of a video datum";
+      video_data = video_buffer_.data();
+      uint8_data = true;
+      frame_off = 0;
+      frame_step = 1;
+    }
+
+    const int plane_size = height * width;
+
+    // Every frame is written below except the padding, which is zeroed here.
+    if (need_pad) {
+      const int video_size = (crop_width > 0 && crop_height > 0) ?
+          crop_frames * channels * crop_height * crop_width :
+          crop_frames * size;
+      caffe_set(video_size, Dtype(0),
+                transformed_data + (batch_item_id * video_size));
+    }
 
     if (crop_width > 0 && crop_height > 0) {
-      CHECK(data.size()) << "Image cropping only support uint8 data";
+      CHECK(uint8_data) << "Image cropping only support uint8 data";
 
       // We only do random crop when we do training.
       if (phase_ == Caffe::TRAIN) {
         h_off = Rand() % (height - crop_height);
         w_off = Rand() % (width - crop_width);
       } else {
-        h_off = (height - crop_height) / 2;
-        w_off = (width - crop_width) / 2;
+        TestCropOffsets(crop_id, height, width, crop_height, crop_width, &h_off,
+                        &w_off);
       }
-      if (mirror && Rand() % 2) {
-        // Copy mirrored version
-        for (int f = 0; f < crop_frames; ++f) {
-          if(need_pad && (f<left_index || f>right_index)) {
-            continue;
-          }
-          // cf: coresponding f
-          int cf = f * v_step;
-          for (int c = 0; c < channels; ++c) {
-            for (int h = 0; h < crop_height; ++h) {
-              for (int w = 0; w < crop_width; ++w) {
-                int data_index = (((f_off + cf) * channels + c) * height + h + h_off) * width + w + w_off;
-                int mean_index = (c * height + h + h_off) * width + w + w_off;
-                int top_index = (((batch_item_id * crop_frames + f)* channels + c) * crop_height + h)
-                    * crop_width + (crop_width - 1 - w);
-                Dtype datum_element =
-                    static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-                transformed_data[top_index] =
-                    (datum_element - mean[mean_index]) * scale;
-              }
-            }
-          }
+      // The crop is copied one row at a time, mirrored rows being written
+      // right to left.
+      const bool do_mirror = (phase_ == Caffe::TRAIN) ?
+          mirror && Rand() % 2 : mirror_view;
+      for (int f = 0; f < crop_frames; ++f) {
+        if(need_pad && (f<left_index || f>right_index)) {
+          continue;
         }
-      } else {
-        // Normal copy
-        for (int f = 0; f < crop_frames; ++f) {
-          if(need_pad && (f<left_index || f>right_index)) {
-            continue;
-          }
-          // cf: coresponding f
-          int cf = f * v_step;
-          for (int c = 0; c < channels; ++c) {
-            for (int h = 0; h < crop_height; ++h) {
-              for (int w = 0; w < crop_width; ++w) {
-                int data_index = (((f_off + cf) * channels + c) * height + h + h_off) * width + w + w_off;
-                int mean_index = (c * height + h + h_off) * width + w + w_off;
-                int top_index = (((batch_item_id * crop_frames + f)* channels + c) * crop_height + h)
-                    * crop_width + w;
-                Dtype datum_element =
-                    static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-                transformed_data[top_index] =
-                    (datum_element - mean[mean_index]) * scale;
-              }
-            }
+        // cf: coresponding f
+        int cf = f * frame_step;
+        const Dtype* frame_mean = FrameMean(mean, f);
+        for (int c = 0; c < channels; ++c) {
+          for (int h = 0; h < crop_height; ++h) {
+            // a per-channel mean repeats one value along the row
+            const Dtype* mean_row = channel_mean_ ? frame_mean + c :
+                frame_mean + (c * height + h + h_off) * width + w_off;
+            const int mean_step = channel_mean_ ? 0 : 1;
+            int data_index = (((frame_off + cf) * channels + c) * height + h
+                + h_off) * width + w_off;
+            int top_index = (((batch_item_id * crop_frames + f) * channels + c)
+                * crop_height + h) * crop_width;
+            caffe_cpu_uint8_sub_scale(crop_width,
+                reinterpret_cast<const uint8_t*>(video_data + data_index),
+                mean_row, mean_step, scale, do_mirror,
+                transformed_data + top_index);
           }
         }
       }
     } else {
       // we will prefer to use data() first, and then try float_data()
       // We only do random crop when we do training.
-      if (data.size()) {
+      if (uint8_data) {
         for (int f = 0; f < crop_frames; ++f) {
           if(need_pad && (f<left_index || f>right_index)) {
             continue;
           }
           // cf: coresponding f
-          int cf = f * v_step;
-          for (int j = 0; j < size; ++j) {
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[(f_off + cf) * size + j]));
-            transformed_data[(batch_item_id * crop_frames + f) * size + j] =
-                (datum_element - mean[j]) * scale;
+          int cf = f * frame_step;
+          const Dtype* frame_mean = FrameMean(mean, f);
+          // each channel plane is one contiguous row
+          for (int c = 0; c < channels; ++c) {
+            caffe_cpu_uint8_sub_scale(plane_size,
+                reinterpret_cast<const uint8_t*>(video_data)
+                + (frame_off + cf) * size + c * plane_size,
+                channel_mean_ ? frame_mean + c : frame_mean + c * plane_size,
+                channel_mean_ ? 0 : 1, scale, false,
+                transformed_data + (batch_item_id * crop_frames + f) * size
+                + c * plane_size);
           }
         }
       } else {
@@ -226,10 +268,12 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
             continue;
           }
           // cf: coresponding f
-          int cf = f * v_step;
+          int cf = f * frame_step;
+          const Dtype* frame_mean = FrameMean(mean, f);
           for (int j = 0; j < size; ++j) {
             transformed_data[(batch_item_id * crop_frames + f) * size + j] =
-                (datum.float_data((f_off + cf) * size + j) - mean[j]) * scale;
+                (datum.float_data((frame_off + cf) * size + j)
+                 - frame_mean[channel_mean_ ? j / plane_size : j]) * scale;
           }
         }
       }
@@ -238,6 +282,59 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
   }
 }
 
+template <typename Dtype>
+int DataTransformer<Dtype>::views_per_sample() const {
+  CHECK(param_.test_crops() == 1 || param_.test_crops() == 5)
+      << "test_crops must be 1 or 5";
+  CHECK((param_.test_crops() == 1 && !param_.test_mirror()) ||
+        param_.crop_size() > 0 ||
+        (param_.video_crop_size_h() > 0 && param_.video_crop_size_w() > 0))
+      << "test_crops and test_mirror require a crop size";
+  if (phase_ == Caffe::TRAIN) {
+    return param_.clips_per_sample();
+  }
+  return param_.clips_per_sample() * param_.test_crops() *
+      (param_.test_mirror() ? 2 : 1);
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::TestCropOffsets(const int crop_id,
+    const int height, const int width, const int crop_height,
+    const int crop_width, int* h_off, int* w_off) const {
+  switch (crop_id) {
+  case 0:  // center
+    *h_off = (height - crop_height) / 2;
+    *w_off = (width - crop_width) / 2;
+    break;
+  case 1:  // top left
+    *h_off = 0;
+    *w_off = 0;
+    break;
+  case 2:  // top right
+    *h_off = 0;
+    *w_off = width - crop_width;
+    break;
+  case 3:  // bottom left
+    *h_off = height - crop_height;
+    *w_off = 0;
+    break;
+  case 4:  // bottom right
+    *h_off = height - crop_height;
+    *w_off = width - crop_width;
+    break;
+  default:
+    LOG(FATAL) << "Unknown test crop " << crop_id;
+  }
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::SetMeanShape(const int num, const int channels,
+    const int height, const int width) {
+  mean_frames_ = num;
+  mean_size_ = channels * height * width;
+  channel_mean_ = (height == 1 && width == 1);
+}
+
 template <typename Dtype>
 void DataTransformer<Dtype>::InitRand() {
   const bool needs_rand = (phase_ == Caffe::TRAIN) &&
@@ -1,7 +1,10 @@
+#include <boost/thread.hpp>
+
 #include <string>
 #include <vector>
 
 #include "caffe/data_layers.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 
 namespace caffe {
@@ -39,59 +42,191 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     data_mean_.FromProto(blob_proto);
     CHECK_GE(data_mean_.num(), 1);
     CHECK_GE(data_mean_.channels(), datum_channels_);
-    CHECK_GE(data_mean_.height(), datum_height_);
-    CHECK_GE(data_mean_.width(), datum_width_);
+    if (data_mean_.height() != 1 || data_mean_.width() != 1) {
+      CHECK_GE(data_mean_.height(), datum_height_);
+      CHECK_GE(data_mean_.width(), datum_width_);
+    }
   } else {
     // Simply initialize an all-empty mean.
     data_mean_.Reshape(1, datum_channels_, datum_height_, datum_width_);
   }
+  data_transformer_.SetMeanShape(data_mean_.num(), data_mean_.channels(),
+      data_mean_.height(), data_mean_.width());
   mean_ = data_mean_.cpu_data();
   data_transformer_.InitRand();
 }
 
+template <typename Dtype>
+BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
+    const LayerParameter& param)
+    : BaseDataLayer<Dtype>(param),
+      current_batch_(NULL), async_copy_(false), device_(-1),
+      release_events_(false), record_timings_(false) {
+  for (int i = 0; i < PREFETCH_COUNT; ++i) {
+    prefetch_free_.push(&prefetch_[i]);
+  }
+}
+
+template <typename Dtype>
+BasePrefetchingDataLayer<Dtype>::~BasePrefetchingDataLayer() {
+#ifndef CPU_ONLY
+  if (release_events_) {
+    for (int i = 0; i < PREFETCH_COUNT; ++i) {
+      CUDA_CHECK(cudaEventDestroy(prefetch_[i].release_event_));
+    }
+  }
+#endif
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
-  // Now, start the prefetch thread. Before calling prefetch, we make two
-  // cpu_data calls so that the prefetch thread does not accidentally make
-  // simultaneous cudaMalloc calls when the main thread is running. In some
-  // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
-  if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
+  // The batches take the shapes DataLayerSetUp gave to the tops. Before
+  // starting the prefetch thread, we make cpu_data calls on every batch so
+  // that the prefetch thread does not accidentally make simultaneous
+  // cudaMalloc calls when the main thread is running. In some GPUs this seems
+  // to cause failures if we do not so.
+  const HostMemory host_memory = static_cast<HostMemory>(
+      this->layer_param_.prefetch_param().host_memory());
+  for (int i = 0; i < PREFETCH_COUNT; ++i) {
+    prefetch_[i].data_.ReshapeLike(*(*top)[0]);
+    prefetch_[i].data_.data()->set_host_memory(host_memory);
+    prefetch_[i].data_.mutable_cpu_data();
+    if (this->output_labels_) {
+      prefetch_[i].label_.ReshapeLike(*(*top)[1]);
+      prefetch_[i].label_.data()->set_host_memory(host_memory);
+      prefetch_[i].label_.mutable_cpu_data();
+    }
   }
-  DLOG(INFO) << "Initializing prefetch";
-  this->CreatePrefetchThread();
-  DLOG(INFO) << "Prefetch initialized.";
+  // The prefetch thread is started by the first Forward, once the phase the
+  // layer runs in is known.
 }
 
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread() {
   this->phase_ = Caffe::phase();
+  this->data_transformer_.set_phase(this->phase_);
   this->data_transformer_.InitRand();
+#ifndef CPU_ONLY
+  async_copy_ = Caffe::mode() == Caffe::GPU &&
+      this->layer_param_.prefetch_param().async_copy();
+  if (async_copy_) {
+    CUDA_CHECK(cudaGetDevice(&device_));
+    // Allocate the device memory here, for the same reason as the host memory
+    // is allocated in LayerSetUp.
+    for (int i = 0; i < PREFETCH_COUNT; ++i) {
+      prefetch_[i].data_.gpu_data();
+      if (this->output_labels_) {
+        prefetch_[i].label_.gpu_data();
+      }
+      if (!release_events_) {
+        CUDA_CHECK(cudaEventCreateWithFlags(&prefetch_[i].release_event_,
+                                            cudaEventDisableTiming));
+      }
+    }
+    release_events_ = true;
+  }
+#endif
   CHECK(StartInternalThread()) << "Thread execution failed";
 }
 
 template <typename Dtype>
-void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
-  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+void BasePrefetchingDataLayer<Dtype>::StopPrefetchThread() {
+  CHECK(StopInternalThread()) << "Thread joining failed";
 }
 
 template <typename Dtype>
-void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
-    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             (*top)[0]->mutable_cpu_data());
+void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+#ifndef CPU_ONLY
+  cudaStream_t stream;
+  if (async_copy_) {
+    CUDA_CHECK(cudaSetDevice(device_));
+    CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+  }
+#endif
+  try {
+    while (!must_stop()) {
+      Batch<Dtype>* batch = prefetch_free_.pop();
+      {
+        // A batch is always loaded completely, so that LoadBatch never leaves
+        // its own threads or cursors half way.
+        boost::this_thread::disable_interruption no_interruption;
+        CPUTimer load_timer;
+        load_timer.Start();
+        batch->timings_ = BatchTimings();
+        LoadBatch(batch);
+#ifndef CPU_ONLY
+        // Copy the batch while the solver computes on the previous one. The
+        // copy only overlaps with the computation when the host memory is
+        // pinned. It must not start before the kernels queued while the
+        // batch was last in use are done with its device memory.
+        if (async_copy_) {
+          CUDA_CHECK(cudaStreamWaitEvent(stream, batch->release_event_, 0));
+          batch->data_.data()->async_gpu_push(stream);
+          if (this->output_labels_) {
+            batch->label_.data()->async_gpu_push(stream);
+          }
+          CUDA_CHECK(cudaStreamSynchronize(stream));
+        }
+#endif
+        batch->timings_.load_ms = load_timer.MilliSeconds();
+      }
+      prefetch_full_.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Stopped while waiting for a free batch.
+  }
+#ifndef CPU_ONLY
+  if (async_copy_) {
+    CUDA_CHECK(cudaStreamDestroy(stream));
+  }
+#endif
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::NextBatch(vector<Blob<Dtype>*>* top) {
+  // Batches already loaded are kept when the phase changes; the next ones
+  // are loaded in the new phase.
+  if (!is_started() || this->phase_ != Caffe::phase()) {
+    StopPrefetchThread();
+    CreatePrefetchThread();
+  }
+  CPUTimer wait_timer;
+  wait_timer.Start();
+  Batch<Dtype>* batch = prefetch_full_.pop();
+  if (record_timings_) {
+    batch->timings_.wait_ms = wait_timer.MilliSeconds();
+    timings_.push_back(batch->timings_);
+  }
+  (*top)[0]->ShareData(batch->data_);
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               (*top)[1]->mutable_cpu_data());
+    (*top)[1]->ShareData(batch->label_);
+  }
+  // The previous batch is no longer used by the tops, so it can be refilled
+  // once the work queued on it so far is done.
+  if (current_batch_ != NULL) {
+#ifndef CPU_ONLY
+    if (release_events_) {
+      CUDA_CHECK(cudaEventRecord(current_batch_->release_event_, 0));
+    }
+#endif
+    prefetch_free_.push(current_batch_);
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  current_batch_ = batch;
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::TakeTimings(
+    vector<BatchTimings>* timings) {
+  timings->insert(timings->end(), timings_.begin(), timings_.end());
+  timings_.clear();
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  NextBatch(top);
 }
 
 #ifdef CPU_ONLY
@@ -7,17 +7,13 @@ namespace caffe {
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-      (*top)[0]->mutable_gpu_data());
+  NextBatch(top);
+  // Copy the batch to the device here rather than in the next layer. This
+  // does nothing when the prefetch thread has already copied it.
+  (*top)[0]->gpu_data();
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-        (*top)[1]->mutable_gpu_data());
+    (*top)[1]->gpu_data();
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
 }
 
 INSTANTIATE_CLASS(BasePrefetchingDataLayer);
@@ -1,3 +1,4 @@
+#include <boost/bind.hpp>
 #include <leveldb/db.h>
 #include <stdint.h>
 
@@ -8,15 +9,17 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/video_io.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
-  this->JoinPrefetchThread();
+  this->StopPrefetchThread();
   // clean up the database resources
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
@@ -73,6 +76,42 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL) << "Unknown database backend";
   }
 
+  // Load the key index for shuffled or sharded reads
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const int views_per_sample = this->data_transformer_.views_per_sample();
+  CHECK_GT(views_per_sample, 0);
+  CHECK_EQ(data_param.batch_size() % views_per_sample, 0)
+      << "batch_size must be a multiple of the views per sample";
+  keys_.clear();
+  key_id_ = 0;
+  if (data_param.shuffle() || data_param.num_shards() > 1) {
+    CHECK_EQ(data_param.backend(), DataParameter_DB_LMDB)
+        << "Shuffled or sharded reads require an LMDB";
+    CHECK_LT(data_param.shard_id(), data_param.num_shards());
+    int index = 0;
+    do {
+      if (index++ % data_param.num_shards() == data_param.shard_id()) {
+        keys_.push_back(string(static_cast<const char*>(mdb_key_.mv_data),
+                               mdb_key_.mv_size));
+      }
+    } while (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
+             == MDB_SUCCESS);
+    CHECK(!keys_.empty()) << "Shard " << data_param.shard_id() << " of "
+        << data_param.num_shards() << " has no records";
+    LOG(INFO) << "Reading " << keys_.size() << " of " << index
+              << " records by key";
+    if (data_param.shuffle()) {
+      const unsigned int prefetch_rng_seed = caffe_rng_rand();
+      prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+      ShuffleKeys();
+    }
+  }
+
+  cache_.clear();
+  cache_lru_.clear();
+  cache_size_ = 0;
+  cache_full_ = false;
+
   // Check if we would need to randomly skip a few data points
   if (this->layer_param_.data_param().rand_skip()) {
     unsigned int skip = caffe_rng_rand() %
@@ -87,8 +126,10 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
         }
         break;
       case DataParameter_DB_LMDB:
-        if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
-            != MDB_SUCCESS) {
+        if (!keys_.empty()) {
+          NextKey();
+        } else if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
+                                  MDB_NEXT) != MDB_SUCCESS) {
           CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
                    MDB_FIRST), MDB_SUCCESS);
         }
@@ -105,6 +146,9 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     datum.ParseFromString(iter_->value().ToString());
     break;
   case DataParameter_DB_LMDB:
+    if (!keys_.empty()) {
+      SeekKey();
+    }
     datum.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
     break;
   default:
@@ -118,14 +162,10 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     if (crop_size > 0) {
       (*top)[0]->Reshape(this->layer_param_.data_param().batch_size(),
                          datum.channels(), crop_size, crop_size);
-      this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-          datum.channels(), crop_size, crop_size);
     } else {
       (*top)[0]->Reshape(
           this->layer_param_.data_param().batch_size(), datum.channels(),
           datum.height(), datum.width());
-      this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-          datum.channels(), datum.height(), datum.width());
     }
     LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
         << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
@@ -156,14 +196,10 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     if (crop_width > 0 && crop_height > 0) {
       (*top)[0]->Reshape(this->layer_param_.data_param().batch_size(),
                          datum.channels() * crop_frames, crop_height, crop_width);
-      this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-          datum.channels() * crop_frames, crop_height, crop_width);
     } else {
       (*top)[0]->Reshape(
           this->layer_param_.data_param().batch_size(), datum.channels() * crop_frames,
           datum.height(), datum.width());
-      this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-          datum.channels() * crop_frames, datum.height(), datum.width());
     }
     LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
         << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
@@ -173,8 +209,6 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // label
   if (this->output_labels_) {
     (*top)[1]->Reshape(this->layer_param_.data_param().batch_size(), 1, 1, 1);
-    this->prefetch_label_.Reshape(this->layer_param_.data_param().batch_size(),
-        1, 1, 1);
   }
   // datum size
   this->datum_frames_ = datum.frames();
@@ -184,44 +218,245 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
-// This function is used to create a thread that prefetches the data.
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
+void DataLayer<Dtype>::ShuffleKeys() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(keys_.begin(), keys_.end(), prefetch_rng);
+}
+
+// Points mdb_value_ at the record of keys_[key_id_].
+template <typename Dtype>
+void DataLayer<Dtype>::SeekKey() {
+  mdb_key_.mv_size = keys_[key_id_].size();
+  mdb_key_.mv_data = const_cast<char*>(keys_[key_id_].data());
+  CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_SET),
+           MDB_SUCCESS) << "Key " << keys_[key_id_] << " not found";
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::NextKey() {
+  ++key_id_;
+  if (key_id_ >= keys_.size()) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    key_id_ = 0;
+    if (this->layer_param_.data_param().shuffle()) {
+      ShuffleKeys();
+    }
+  }
+}
+
+template <typename Dtype>
+bool DataLayer<Dtype>::ReadCachedItem(const string& key, const int item_id) {
+  typename std::map<string, shared_ptr<CacheEntry> >::iterator it =
+      cache_.find(key);
+  if (it == cache_.end()) {
+    return false;
+  }
+  const shared_ptr<CacheEntry>& entry = it->second;
+  if (this->layer_param_.data_param().cache_policy() ==
+      DataParameter_CachePolicy_LRU) {
+    cache_lru_.splice(cache_lru_.begin(), cache_lru_, entry->lru_pos);
+  }
+  batch_datums_[item_id] = entry->header;
+  batch_data_[item_id] = entry->data.data();
+  batch_data_sizes_[item_id] = entry->data.size();
+  batch_cache_entries_[item_id] = entry;
+  return true;
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::CacheItem(const string& key, const int item_id) {
+  const DataParameter& data_param = this->layer_param_.data_param();
+  const Datum& datum = batch_datums_[item_id];
+  // An encoded datum is kept decoded, so that it is not decoded again.
+  size_t data_size = batch_data_sizes_[item_id];
+  if (datum.encoded_frames_size() > 0) {
+    data_size = datum.frames() * datum.channels() * datum.height() *
+        datum.width();
+  }
+  const size_t entry_size = key.size() + data_size +
+      datum.float_data_size() * sizeof(float);
+  if (entry_size > data_param.cache_bytes()) {
+    return;
+  }
+  if (data_param.cache_policy() == DataParameter_CachePolicy_LRU) {
+    while (cache_size_ + entry_size > data_param.cache_bytes()) {
+      typename std::map<string, shared_ptr<CacheEntry> >::iterator it =
+          cache_.find(cache_lru_.back());
+      cache_size_ -= it->second->size;
+      cache_.erase(it);
+      cache_lru_.pop_back();
+    }
+  } else if (cache_size_ + entry_size > data_param.cache_bytes()) {
+    if (!cache_full_) {
+      LOG(INFO) << "The cache is full with " << cache_.size() << " datums";
+      cache_full_ = true;
+    }
+    return;
+  }
+  shared_ptr<CacheEntry> entry(new CacheEntry());
+  // The item is pointed at the entry below, so its datum can be moved.
+  entry->header.Swap(&batch_datums_[item_id]);
+  if (entry->header.encoded_frames_size() > 0) {
+    CHECK(DecodeVideoDatum(&entry->header))
+        << "Could not decode the frames of a video datum";
+  } else if (!entry->header.has_data()) {
+    // With LMDB the data is still in the memory map.
+    entry->header.set_data(batch_data_[item_id], batch_data_sizes_[item_id]);
+  }
+  entry->data.swap(*entry->header.mutable_data());
+  entry->header.clear_data();
+  entry->size = entry_size;
+  cache_lru_.push_front(key);
+  entry->lru_pos = cache_lru_.begin();
+  cache_[key] = entry;
+  cache_size_ += entry_size;
+  CHECK(ReadCachedItem(key, item_id));
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::CreatePrefetchThread() {
+  // The views of a datum depend on the phase, which may differ from the one
+  // the layer was set up in.
+  this->data_transformer_.set_phase(Caffe::phase());
+  CHECK_EQ(this->layer_param_.data_param().batch_size() %
+           this->data_transformer_.views_per_sample(), 0)
+      << "batch_size must be a multiple of the views per sample";
+  // The workers past the first get a copy of data_transformer_, mean shape
+  // and phase included. Their rngs are seeded here in order, so that the
+  // batches do not depend on the thread scheduling.
+  const int num_workers = this->layer_param_.data_param().transform_threads();
+  CHECK_GT(num_workers, 0);
+  transformers_.clear();
+  for (int i = 1; i < num_workers; ++i) {
+    transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->data_transformer_)));
+    transformers_.back()->InitRand();
+  }
+  if (!transform_pool_ || transform_pool_->num_threads() != num_workers) {
+    transform_pool_.reset(new ThreadPool(num_workers));
+  }
+  BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread();
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::TransformItems(const int worker_id, Dtype* top_data) {
+  DataTransformer<Dtype>* transformer = (worker_id == 0) ?
+      &this->data_transformer_ : transformers_[worker_id - 1].get();
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  const int views_per_sample = transformer->views_per_sample();
+  const int num_workers = transformers_.size() + 1;
+  for (int item_id = worker_id; item_id < batch_size;
+       item_id += num_workers) {
+    // Apply data transformations (mirror, scale, crop...)
+    const int sample_id = item_id / views_per_sample;
+    transformer->Transform(item_id, batch_datums_[sample_id],
+        batch_data_[sample_id], batch_data_sizes_[sample_id], this->mean_,
+        top_data, item_id % views_per_sample);
+  }
+}
+
+// This function is called on the prefetch thread to load a batch.
+template <typename Dtype>
+void DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  Dtype* top_data = batch->data_.mutable_cpu_data();
   Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
   if (this->output_labels_) {
-    top_label = this->prefetch_label_.mutable_cpu_data();
+    top_label = batch->label_.mutable_cpu_data();
   }
-  const int batch_size = this->layer_param_.data_param().batch_size();
+  // Each datum read fills views_per_sample consecutive items of the batch.
+  const int views_per_sample = this->data_transformer_.views_per_sample();
+  const int num_samples =
+      this->layer_param_.data_param().batch_size() / views_per_sample;
+  batch_datums_.resize(num_samples);
+  batch_data_.resize(num_samples);
+  batch_data_sizes_.resize(num_samples);
+  batch_cache_entries_.clear();
+  batch_cache_entries_.resize(num_samples);
+  BatchTimings* timings = &batch->timings_;
+  CPUTimer timer;
+  const bool use_cache = this->layer_param_.data_param().cache_bytes() > 0;
+  string key;
 
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
+  for (int item_id = 0; item_id < num_samples; ++item_id) {
+    Datum& datum = batch_datums_[item_id];
+    // get a blob, from the cache if it holds it
+    timer.Start();
+    bool cached = false;
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
+      {
       CHECK(iter_);
       CHECK(iter_->Valid());
-      datum.ParseFromString(iter_->value().ToString());
+      if (use_cache) {
+        key = iter_->key().ToString();
+        cached = ReadCachedItem(key, item_id);
+      }
+      if (cached) {
+        break;
+      }
+      // The value is only valid until the iterator moves, so it is parsed
+      // into the datum, without the copy ToString would make first.
+      const leveldb::Slice value = iter_->value();
+      timings->fetch_ms += timer.MilliSeconds();
+      timer.Start();
+      datum.ParseFromArray(value.data(), value.size());
+      batch_data_[item_id] = datum.data().data();
+      batch_data_sizes_[item_id] = datum.data().size();
+      }
       break;
     case DataParameter_DB_LMDB:
-      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
+      // The read transaction stays open for the life of the layer, so the
+      // data can be transformed in place in the memory map.
+      if (!keys_.empty()) {
+        if (use_cache) {
+          key = keys_[key_id_];
+          cached = ReadCachedItem(key, item_id);
+        }
+        if (!cached) {
+          SeekKey();
+        }
+      } else {
+        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
+                &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
+        if (use_cache) {
+          key.assign(static_cast<const char*>(mdb_key_.mv_data),
+                     mdb_key_.mv_size);
+          cached = ReadCachedItem(key, item_id);
+        }
+      }
+      if (cached) {
+        break;
+      }
+      timings->fetch_ms += timer.MilliSeconds();
+      timer.Start();
+      CHECK(ParseDatumHeader(mdb_value_.mv_data, mdb_value_.mv_size, &datum,
+          &batch_data_[item_id], &batch_data_sizes_[item_id]))
+          << "Failed to parse a datum";
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
-
-    // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
+    if (cached) {
+      timings->fetch_ms += timer.MilliSeconds();
+    } else {
+      if (use_cache) {
+        CacheItem(key, item_id);
+      }
+      timings->parse_ms += timer.MilliSeconds();
+    }
 
     if (this->output_labels_) {
-      top_label[item_id] = datum.label();
+      for (int view_id = 0; view_id < views_per_sample; ++view_id) {
+        top_label[item_id * views_per_sample + view_id] = datum.label();
+      }
     }
 
     // go to the next iter
+    timer.Start();
     switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
       iter_->Next();
@@ -232,7 +467,9 @@ void DataLayer<Dtype>::InternalThreadEntry() {
       }
       break;
     case DataParameter_DB_LMDB:
-      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
+      if (!keys_.empty()) {
+        NextKey();
+      } else if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
               &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
         // We have reached the end. Restart from the first.
         DLOG(INFO) << "Restarting data prefetching from start.";
@@ -243,7 +480,14 @@ void DataLayer<Dtype>::InternalThreadEntry() {
     default:
       LOG(FATAL) << "Unknown database backend";
     }
+    timings->fetch_ms += timer.MilliSeconds();
   }
+
+  // Transform the batch on the workers; this thread is the first one.
+  timer.Start();
+  transform_pool_->Run(boost::bind(&DataLayer<Dtype>::TransformItems, this,
+                                   _1, top_data));
+  timings->transform_ms = timer.MilliSeconds();
 }
 
 INSTANTIATE_CLASS(DataLayer);
@@ -1,8 +1,11 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 #include <algorithm>
 
@@ -110,7 +113,7 @@ void RecursiveOnceLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   // 
   //
   weight_buffer_.Reshape(1, 1, M_, K_);
-  tmp_buffer_.Reshape(1, M_, height_, width_);
+  ReshapeThreadBuffers();
   //int tmp_size = M_ * N_ >= group_out_ ? M_ * N_ : group_out_;
   //tmp_buffer_.Reshape(1, 1, 1, tmp_size);
 
@@ -122,148 +125,206 @@ void RecursiveOnceLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 }
 
 template <typename Dtype>
-void RecursiveOnceLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {
-  for (int i = 0; i < bottom.size(); ++i) {
+void RecursiveOnceLayer<Dtype>::ReshapeThreadBuffers() {
+  // The samples of the batch are split over the threads of the CPU pool, and
+  // each thread has its own slice of tmp_buffer_ and of the weight and bias
+  // gradients, which are summed once all threads are done.
+  buffer_threads_ = Caffe::thread_pool().num_threads();
+  tmp_buffer_.Reshape(buffer_threads_, M_, height_, width_);
+  thread_weight_diff_.Reshape(buffer_threads_, 1, M_, K_);
+  thread_bias_diff_.Reshape(buffer_threads_, 1, 1, M_);
+}
 
-    const Dtype* bottom_data = bottom[i]->cpu_data();
-    Dtype* top_data = (*top)[i]->mutable_cpu_data();
-    int* mask = NULL;
-    mask = max_idx_.mutable_cpu_data();
-    Dtype* weight_buf_data = weight_buffer_.mutable_cpu_data(); // reshaped weight matrix
-    Dtype* out_data = tmp_buffer_.mutable_cpu_data();       // tmp output
-    const Dtype* weight = this->blobs_[0]->cpu_data();
+template <typename Dtype>
+void RecursiveOnceLayer<Dtype>::ForwardSamples_cpu(const Dtype* bottom_data,
+      const Dtype* weight_buf_data, Dtype* top_data, int* mask,
+      Dtype* out_data, const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  out_data += tmp_buffer_.offset(thread_id);  // tmp output
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  int across_offset = vl_ * stride_ * N_;  // number of values in an input region
+  int top_offset = vl_ * N_;  // number of values in an output region / column
+  const int bottom_sample = channels_ * N_;
+  const int top_sample = group_out_ * top_offset;
 
-    //int weight_offset = M_ * K_;  // number of filter parameters in a group
-    int across_offset = vl_ * stride_ * N_;  // number of values in an input region
-    int top_offset = vl_ * N_;  // number of values in an output region / column
-    int src_weight_offset = vl_ * vl_ * num_uv_;  // number of values in one set of src weight 
-    
-    // reshape weight matrix  
-    //   -- dst weight matrix [assemble_size*vl , across*vl]
-    //   -- src weight matrix [assemble_size , num_uv, vl, vl]
-    caffe_set(M_ * K_, Dtype(0.0), weight_buf_data);
-    for(int as = 0; as < assemble_size_; ++as) {
-      for(int h = 0; h < vl_; ++h) {
-        for (int wc = 0; wc < num_uv_; ++wc) {
-          caffe_copy(vl_, weight+src_weight_offset * as + vl_*vl_*wc + vl_*h,
-                     weight_buf_data+(as*vl_+h)*K_+vl_*relative_position_[wc]);
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < group_out_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
+          (Dtype)1., weight_buf_data , bottom_data + n * bottom_sample + across_offset * g,
+          (Dtype)0., out_data);
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, 
+            N_, 1, (Dtype)1., bias,
+            bias_multiplier_.cpu_data(),
+            (Dtype)1., out_data);
+      }
+      // max-out to top
+      Dtype * top_data_ng = top_data + n * top_sample + top_offset * g;
+      caffe_copy(top_offset, out_data, top_data_ng);
+      int* mask_ng = mask + n * top_sample + top_offset * g;
+      caffe_set(top_offset, 0, mask_ng);
+      if (multi_weights_) {
+        for (int nid = 1; nid < assemble_size_; ++nid) {
+          caffe_cpu_vimax(top_offset, top_data_ng, mask_ng, out_data + top_offset * nid, nid);
         }
+        // uncomment to test mean-out for gradient check (?)
+        //for(int sdf=0;sdf<top_offset;sdf++)
+        //        top_data_ng[sdf] /= assemble_size_;
       }
     }
+  }
+}
 
-    for (int n = 0; n < num_; ++n) {
-      for (int g = 0; g < group_out_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-            (Dtype)1., weight_buf_data , bottom_data + bottom[i]->offset(n) + across_offset * g,
-            (Dtype)0., out_data);
-        if (bias_term_) {
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, 
-              N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-              bias_multiplier_.cpu_data(),
-              (Dtype)1., out_data);
-        }
-        // max-out to top
-        Dtype * top_data_ng = top_data + (*top)[i]->offset(n) + top_offset * g;
-        caffe_copy(top_offset, out_data, top_data_ng);
-        int* mask_ng = mask + max_idx_.offset(n) + top_offset * g;
-        caffe_set(top_offset, 0, mask_ng);
-        if (multi_weights_) {
-          for (int nid = 1; nid < assemble_size_; ++nid) {
-            caffe_cpu_vimax(top_offset, top_data_ng, mask_ng, out_data + top_offset * nid, nid);
-          }
-          // uncomment to test mean-out for gradient check (?)
-          //for(int sdf=0;sdf<top_offset;sdf++)
-          //        top_data_ng[sdf] /= assemble_size_;
-        }
+template <typename Dtype>
+void RecursiveOnceLayer<Dtype>::BackwardSamples_cpu(const Dtype* top_diff,
+      const int* mask, const Dtype* bottom_data, Dtype* bottom_diff,
+      Dtype* weight_buf_diff, Dtype* bias_diff, Dtype* tmp_diff,
+      const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  tmp_diff += tmp_buffer_.offset(thread_id);
+  if (weight_buf_diff) {
+    weight_buf_diff += thread_weight_diff_.offset(thread_id);
+  }
+  if (bias_diff) {
+    bias_diff += thread_bias_diff_.offset(thread_id);
+  }
+  const Dtype* weight_buf_data = weight_buffer_.cpu_data(); // reshaped weight matrix
+  const int top_offset = vl_ * N_;
+  int across_offset = vl_ * stride_ * N_;  // number of values in an input region
+  const int bottom_sample = channels_ * N_;
+  const int top_sample = group_out_ * top_offset;
+
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < group_out_; ++g) {
+      // top to tmp
+      caffe_set(M_*N_, Dtype(0.0), tmp_diff);
+      int offset_ng = n * top_sample + top_offset * g;
+      caffe_cpu_backfill(top_offset, top_diff + offset_ng,
+                         mask + offset_ng, tmp_diff);
+      // Bias gradient, if necessary.
+      if (bias_diff) {
+        caffe_cpu_gemv<Dtype>(CblasNoTrans, vl_ * assemble_size_, N_,
+            1., tmp_diff,
+            bias_multiplier_.cpu_data(), 1.,
+            bias_diff);
+      }
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      if (weight_buf_diff) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+            (Dtype)1., tmp_diff,
+            bottom_data + n * bottom_sample + g * across_offset, (Dtype)1.,
+            weight_buf_diff);
+      }
+      // gradient w.r.t. bottom data, if necessary.
+      if (bottom_diff) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+            (Dtype)1., weight_buf_data,
+            tmp_diff,
+            (Dtype)1., bottom_diff + n * bottom_sample + g * across_offset);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void RecursiveOnceLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  if (buffer_threads_ != Caffe::thread_pool().num_threads()) {
+    ReshapeThreadBuffers();
+  }
+  Dtype* weight_buf_data = weight_buffer_.mutable_cpu_data(); // reshaped weight matrix
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  int src_weight_offset = vl_ * vl_ * num_uv_;  // number of values in one set of src weight 
+  
+  // reshape weight matrix  
+  //   -- dst weight matrix [assemble_size*vl , across*vl]
+  //   -- src weight matrix [assemble_size , num_uv, vl, vl]
+  caffe_set(M_ * K_, Dtype(0.0), weight_buf_data);
+  for(int as = 0; as < assemble_size_; ++as) {
+    for(int h = 0; h < vl_; ++h) {
+      for (int wc = 0; wc < num_uv_; ++wc) {
+        caffe_copy(vl_, weight+src_weight_offset * as + vl_*vl_*wc + vl_*h,
+                   weight_buf_data+(as*vl_+h)*K_+vl_*relative_position_[wc]);
       }
     }
+  }
+  if (bias_term_) {
+    this->blobs_[1]->cpu_data();
+  }
 
+  for (int i = 0; i < bottom.size(); ++i) {
+    Caffe::thread_pool().Run(boost::bind(
+        &RecursiveOnceLayer<Dtype>::ForwardSamples_cpu, this,
+        bottom[i]->cpu_data(), weight_buf_data,
+        (*top)[i]->mutable_cpu_data(), max_idx_.mutable_cpu_data(),
+        tmp_buffer_.mutable_cpu_data(), _1));
   }
 }
 
 template <typename Dtype>
 void RecursiveOnceLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-
+  if (buffer_threads_ != Caffe::thread_pool().num_threads()) {
+    ReshapeThreadBuffers();
+  }
   Dtype* tmp_diff = tmp_buffer_.mutable_cpu_diff();
   const int* mask = max_idx_.cpu_data();
-  const Dtype* weight = NULL;
-  Dtype* weight_diff = NULL;
+  Dtype* weight_buf_diff = NULL; // reshaped weight matrix diff, per thread
   if (this->param_propagate_down_[0]) {
-    weight = this->blobs_[0]->cpu_data();
-    weight_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
+    weight_buf_diff = thread_weight_diff_.mutable_cpu_diff();
+    caffe_set(thread_weight_diff_.count(), Dtype(0), weight_buf_diff);
   }
   Dtype* bias_diff = NULL;
   if (bias_term_ && this->param_propagate_down_[1]) {
-    bias_diff = this->blobs_[1]->mutable_cpu_diff();
-    caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
+    bias_diff = thread_bias_diff_.mutable_cpu_diff();
+    caffe_set(thread_bias_diff_.count(), Dtype(0), bias_diff);
   }
-
-  const Dtype* weight_buf_data = weight_buffer_.cpu_data(); // reshaped weight matrix
-  Dtype* weight_buf_diff = weight_buffer_.mutable_cpu_diff(); // reshaped weight matrix diff
-  caffe_set(M_ * K_, Dtype(0), weight_buf_diff);
-
-  const int top_offset = vl_ * N_;
-  int across_offset = vl_ * stride_ * N_;  // number of values in an input region
-  int src_weight_offset = vl_ * vl_ * num_uv_;  // number of values in one set of src weight 
+  // The threads read the reshaped weight through cpu_data, which only reads
+  // once it is on the host.
+  weight_buffer_.cpu_data();
 
   for (int i = 0; i < top.size(); ++i) {
-    const Dtype* top_diff = top[i]->cpu_diff();
-    const Dtype* bottom_data = (*bottom)[i]->cpu_data();
     Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
     caffe_set(num_*channels_*height_*width_, Dtype(0), bottom_diff);
     
-    if (this->param_propagate_down_[0] || propagate_down[i] || 
-                    bias_term_ && this->param_propagate_down_[1]) {
-      for (int n = 0; n < num_; ++n) {
-        for (int g = 0; g < group_out_; ++g) {
-          // top to tmp
-          caffe_set(M_*N_, Dtype(0.0), tmp_diff);
-          int offset_ng = top[0]->offset(n) + top_offset * g;
-          caffe_cpu_backfill(top_offset, top_diff + offset_ng,
-                             mask + offset_ng, tmp_diff);
-          // Bias gradient, if necessary.
-          if (bias_term_ && this->param_propagate_down_[1]) {
-            caffe_cpu_gemv<Dtype>(CblasNoTrans, vl_ * assemble_size_, N_,
-                1., tmp_diff,
-                bias_multiplier_.cpu_data(), 1.,
-                bias_diff);
-          }
-          if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (weight_buf_diff || propagate_down[i] || bias_diff) {
+      Caffe::thread_pool().Run(boost::bind(
+          &RecursiveOnceLayer<Dtype>::BackwardSamples_cpu, this,
+          top[i]->cpu_diff(), mask, (*bottom)[i]->cpu_data(),
+          propagate_down[i] ? bottom_diff : NULL, weight_buf_diff,
+          bias_diff, tmp_diff, _1));
+    }
+  }
 
-            // gradient w.r.t. weight. Note that we will accumulate diffs.
-            if (this->param_propagate_down_[0]) {
-              caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                  (Dtype)1., tmp_diff,
-                  bottom_data + (*bottom)[i]->offset(n) + g * across_offset, (Dtype)1.,
-                  weight_buf_diff);
-            }
-            // weight_buf diff back to the weight diff 
-            // reshape weight matrix  
-            //   -- dst weight matrix [assemble_size*vl , across*vl]
-            //   -- src weight matrix [assemble_size , num_uv, vl, vl]
-            for(int as = 0; as < assemble_size_; ++as) {
-              for(int h = 0; h < vl_; ++h) {
-                for (int wc = 0; wc < num_uv_; ++wc) {
-                  caffe_copy(vl_,
-                             weight_buf_diff+(as*vl_+h)*K_+vl_*relative_position_[wc],
-                             weight_diff+src_weight_offset * as + vl_*vl_*wc + vl_*h);
-                }
-              }
-            }
-            // gradient w.r.t. bottom data, if necessary.
-            if (propagate_down[i]) {
-              if (weight == NULL) {
-                weight = this->blobs_[0]->cpu_data();
-              }
-              caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                  (Dtype)1., weight_buf_data,
-                  tmp_diff,
-                  (Dtype)1., bottom_diff + (*bottom)[i]->offset(n) + g * across_offset);
-            }
-          }
+  // Sum the gradients of the threads.
+  for (int t = 1; t < buffer_threads_; ++t) {
+    if (weight_buf_diff) {
+      caffe_axpy(M_ * K_, Dtype(1), weight_buf_diff + t * M_ * K_,
+          weight_buf_diff);
+    }
+    if (bias_diff) {
+      caffe_axpy(M_, Dtype(1), bias_diff + t * M_, bias_diff);
+    }
+  }
+  if (bias_diff) {
+    caffe_copy(M_, bias_diff, this->blobs_[1]->mutable_cpu_diff());
+  }
+  if (weight_buf_diff) {
+    // weight_buf diff back to the weight diff 
+    // reshape weight matrix  
+    //   -- dst weight matrix [assemble_size*vl , across*vl]
+    //   -- src weight matrix [assemble_size , num_uv, vl, vl]
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    caffe_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
+    int src_weight_offset = vl_ * vl_ * num_uv_;  // number of values in one set of src weight 
+    for(int as = 0; as < assemble_size_; ++as) {
+      for(int h = 0; h < vl_; ++h) {
+        for (int wc = 0; wc < num_uv_; ++wc) {
+          caffe_copy(vl_,
+                     weight_buf_diff+(as*vl_+h)*K_+vl_*relative_position_[wc],
+                     weight_diff+src_weight_offset * as + vl_*vl_*wc + vl_*h);
         }
       }
     }
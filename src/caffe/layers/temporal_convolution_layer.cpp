@@ -1,8 +1,11 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 #include <algorithm>
 
@@ -85,184 +88,338 @@ void TemporalConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom
   M_ = num_output_;
   N_ = height_ * width_;
   K_ = kernel_size_ * vl_;
-  // 
-  // Set up padded_bottom_i_ if pad is needed
-  if (pad_ > 0) {
-    padded_bottom_i_.Reshape(1, K_, height_, width_);
-  }
-  // Set up the all ones "bias multiplier" for adding biases by BLAS
+  // Set up the all ones "bias multiplier" for adding biases by BLAS, and the
+  // ones over all windows of the batch that broadcast bias_plane_ to the top.
   if (bias_term_) {
     bias_multiplier_.Reshape(1, 1, 1, N_);
     caffe_set(N_, Dtype(1), bias_multiplier_.mutable_cpu_data());
+    window_multiplier_.Reshape(1, 1, 1, num_ * group_out_);
+    caffe_set(num_ * group_out_, Dtype(1),
+        window_multiplier_.mutable_cpu_data());
+    bias_plane_.Reshape(1, 1, M_, N_);
   }
+  // On small maps the CPU runs all windows of a sample as a single GEMM over
+  // col_buffer_, where the windows are unrolled side by side. A row of ones
+  // under them multiplies the bias column of weight_bias_, and the frames
+  // that fall into the padding stay zero, as BuildWindowColumns only writes
+  // the frames inside the input.
+  batched_gemm_ = N_ <= this->layer_param_.temporal_convolution_param()
+      .batched_gemm_max_size();
+  if (batched_gemm_) {
+    weight_bias_.Reshape(1, 1, M_, bias_term_ ? K_ + 1 : K_);
+  }
+  ReshapeThreadBuffers();
 }
 
 template <typename Dtype>
-void TemporalConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {
-  for (int i = 0; i < bottom.size(); ++i) {
+void TemporalConvolutionLayer<Dtype>::ReshapeThreadBuffers() {
+  // The samples of the batch are split over the threads of the CPU pool, and
+  // each thread has its own slice of the scratch buffers and of the weight
+  // gradient, which are summed once all threads are done.
+  buffer_threads_ = Caffe::thread_pool().num_threads();
+  if (!batched_gemm_) {
+    thread_weight_diff_.Reshape(buffer_threads_, 1, M_, K_);
+    return;
+  }
+  const int rows = bias_term_ ? K_ + 1 : K_;
+  const int col_width = group_out_ * N_;
+  thread_weight_diff_.Reshape(buffer_threads_, 1, M_, rows);
+  col_buffer_.Reshape(buffer_threads_, 1, rows, col_width);
+  for (int t = 0; t < buffer_threads_; ++t) {
+    Dtype* col = col_buffer_.mutable_cpu_data() + col_buffer_.offset(t);
+    caffe_set(K_ * col_width, Dtype(0), col);
+    if (bias_term_) {
+      caffe_set(col_width, Dtype(1), col + K_ * col_width);
+    }
+  }
+  top_buffer_.Reshape(buffer_threads_, 1, M_, col_width);
+}
 
-    const Dtype* bottom_data = bottom[i]->cpu_data();
-    Dtype* top_data = (*top)[i]->mutable_cpu_data();
-    const Dtype* weight = this->blobs_[0]->cpu_data();
+template <typename Dtype>
+void TemporalConvolutionLayer<Dtype>::BuildWindowColumns(
+      const Dtype* bottom_data, Dtype* col) {
+  const int col_width = group_out_ * N_;
+  for (int g = 0; g < group_out_; ++g) {
+    int first, last;
+    ValidTaps(g, &first, &last);
+    for (int j = first; j < last; ++j) {
+      const int t = g * stride_ - pad_ + j;
+      for (int c = 0; c < vl_; ++c) {
+        caffe_copy(N_, bottom_data + (t * vl_ + c) * N_,
+            col + (j * vl_ + c) * col_width + g * N_);
+      }
+    }
+  }
+}
 
-    int bottom_offset = vl_ * N_;  // number of values in an input region
-    int top_offset = num_output_ * N_;  // number of values in an output region / column
+template <typename Dtype>
+void TemporalConvolutionLayer<Dtype>::AccumulateWindowColumns(
+      const Dtype* col, Dtype* bottom_diff) {
+  const int col_width = group_out_ * N_;
+  for (int g = 0; g < group_out_; ++g) {
+    int first, last;
+    ValidTaps(g, &first, &last);
+    for (int j = first; j < last; ++j) {
+      const int t = g * stride_ - pad_ + j;
+      for (int c = 0; c < vl_; ++c) {
+        caffe_axpy(N_, Dtype(1), col + (j * vl_ + c) * col_width + g * N_,
+            bottom_diff + (t * vl_ + c) * N_);
+      }
+    }
+  }
+}
 
-    for (int n = 0; n < num_; ++n) {
+template <typename Dtype>
+void TemporalConvolutionLayer<Dtype>::ForwardSamples_cpu(
+      const Dtype* bottom_data, const Dtype* weight, Dtype* top_data,
+      Dtype* col, Dtype* top_buffer, const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  const int bottom_offset = vl_ * N_;  // number of values in an input region
+  const int top_offset = num_output_ * N_;  // number of values in an output region / column
+  const int bottom_sample = channels_ * N_;
+  const int top_sample = group_out_ * top_offset;
+  if (batched_gemm_) {
+    const int rows = bias_term_ ? K_ + 1 : K_;
+    const int col_width = group_out_ * N_;
+    col += col_buffer_.offset(thread_id);
+    top_buffer += top_buffer_.offset(thread_id);
+    for (int n = begin; n < end; ++n) {
+      BuildWindowColumns(bottom_data + n * bottom_sample, col);
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, col_width, rows,
+          (Dtype)1., weight, col, (Dtype)0., top_buffer);
+      // top_buffer_ is (output, window, pixel); the top is (window, output,
+      // pixel).
+      Dtype* top_n = top_data + n * top_sample;
       for (int g = 0; g < group_out_; ++g) {
-        // -      -      -      -      #   #   #   #   #   #   #   #      #     -     -     -     -
-        // 0                  pad-1   pad                            pad+group-1  pad+group
-        if (g * stride_ < pad_) {
-          // pad left
-          caffe_set((pad_ - g * stride_) * bottom_offset, Dtype(0), padded_bottom_i_.mutable_cpu_data());
-          caffe_copy((kernel_size_ - pad_ + g * stride_) * vl_ * N_, 
-                          bottom_data + bottom[i]->offset(n), 
-                          padded_bottom_i_.mutable_cpu_data() + (pad_ - g * stride_) * bottom_offset);
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-              (Dtype)1., weight, padded_bottom_i_.cpu_data(),
-              (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
-        } else if (g * stride_ + kernel_size_  > pad_ + group_) {
-          // pad right
-          caffe_copy((pad_ + group_ - g * stride_) * bottom_offset, 
-                     bottom_data + bottom[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-                     padded_bottom_i_.mutable_cpu_data());
-          caffe_set((kernel_size_ + g * stride_ - pad_ - group_) * bottom_offset, Dtype(0), 
-                     padded_bottom_i_.mutable_cpu_data() + (pad_ + group_ - g * stride_) * bottom_offset);
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-              (Dtype)1., weight, padded_bottom_i_.cpu_data(),
-              (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
-        } else {
-          // no pad
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-              (Dtype)1., weight, bottom_data + bottom[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-              (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
+        for (int m = 0; m < M_; ++m) {
+          caffe_copy(N_, top_buffer + m * col_width + g * N_,
+              top_n + (g * M_ + m) * N_);
         }
-        if (bias_term_) {
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, 
-              N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-              bias_multiplier_.cpu_data(),
-              (Dtype)1., top_data + (*top)[i]->offset(n) + top_offset * g);
+      }
+    }
+    return;
+  }
+  // The top already holds the bias, or zeros.
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < group_out_; ++g) {
+      // -      -      -      -      #   #   #   #   #   #   #   #      #     -     -     -     -
+      // 0                  pad-1   pad                            pad+group-1  pad+group
+      // The padded frames are zero, so only the taps [first, last) inside
+      // the input take part: the GEMM runs over those columns of the
+      // weight and those frames of the bottom, in place.
+      int first, last;
+      ValidTaps(g, &first, &last);
+      if (first >= last) {
+        continue;
+      }
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_,
+          (last - first) * vl_, (Dtype)1., weight + first * vl_, K_,
+          bottom_data + n * bottom_sample
+              + (g * stride_ - pad_ + first) * bottom_offset, N_,
+          (Dtype)1., top_data + n * top_sample + top_offset * g, N_);
+    }
+  }
+}
+
+template <typename Dtype>
+void TemporalConvolutionLayer<Dtype>::BackwardSamples_cpu(
+      const Dtype* top_diff, const Dtype* bottom_data, Dtype* bottom_diff,
+      Dtype* weight_diff, Dtype* col, Dtype* col_diff,
+      Dtype* top_buffer_diff, const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  const int bottom_offset = vl_ * N_;  // number of values in an input region
+  const int top_offset = num_output_ * N_;
+  const int bottom_sample = channels_ * N_;
+  const int top_sample = group_out_ * top_offset;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  if (weight_diff) {
+    weight_diff += thread_weight_diff_.offset(thread_id);
+  }
+  if (batched_gemm_) {
+    const int rows = bias_term_ ? K_ + 1 : K_;
+    const int col_width = group_out_ * N_;
+    col += col_buffer_.offset(thread_id);
+    col_diff += col_buffer_.offset(thread_id);
+    top_buffer_diff += top_buffer_.offset(thread_id);
+    for (int n = begin; n < end; ++n) {
+      const Dtype* top_diff_n = top_diff + n * top_sample;
+      for (int g = 0; g < group_out_; ++g) {
+        for (int m = 0; m < M_; ++m) {
+          caffe_copy(N_, top_diff_n + (g * M_ + m) * N_,
+              top_buffer_diff + m * col_width + g * N_);
         }
       }
+      // gradient w.r.t. weight and bias together; the bias takes the last
+      // column, against the row of ones.
+      if (weight_diff) {
+        BuildWindowColumns(bottom_data + n * bottom_sample, col);
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, rows, col_width,
+            (Dtype)1., top_buffer_diff, col, (Dtype)1., weight_diff);
+      }
+      // gradient w.r.t. bottom data, if necessary.
+      if (bottom_diff) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, col_width, M_,
+            (Dtype)1., weight, top_buffer_diff, (Dtype)0., col_diff);
+        AccumulateWindowColumns(col_diff, bottom_diff + n * bottom_sample);
+      }
     }
+    return;
+  }
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < group_out_; ++g) {
+
+      int offset_ng = n * top_sample + top_offset * g;
+      // Only the taps inside the input have gradients; the ones in the
+      // padding are skipped, as in the forward pass.
+      int first, last;
+      ValidTaps(g, &first, &last);
+      if (first >= last) {
+        continue;
+      }
+      const int k = (last - first) * vl_;
+      const int offset_frames = n * bottom_sample
+          + (g * stride_ - pad_ + first) * bottom_offset;
+
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      if (weight_diff) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, k, N_,
+            (Dtype)1., top_diff + offset_ng, N_,
+            bottom_data + offset_frames, N_,
+            (Dtype)1., weight_diff + first * vl_, K_);
+      }
+      // gradient w.r.t. bottom data, if necessary.
+      if (bottom_diff) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, k, N_, M_,
+            (Dtype)1., weight + first * vl_, K_,
+            top_diff + offset_ng, N_,
+            (Dtype)1., bottom_diff + offset_frames, N_);
+      }
+    }
+  }
+}
 
+template <typename Dtype>
+void TemporalConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  if (buffer_threads_ != Caffe::thread_pool().num_threads()) {
+    ReshapeThreadBuffers();
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* col = NULL;
+  Dtype* top_buffer = NULL;
+  if (batched_gemm_) {
+    // [weight | bias], so that the bias is added by the same GEMM
+    const int rows = bias_term_ ? K_ + 1 : K_;
+    Dtype* weight_bias = weight_bias_.mutable_cpu_data();
+    for (int m = 0; m < M_; ++m) {
+      caffe_copy(K_, weight + m * K_, weight_bias + m * rows);
+      if (bias_term_) {
+        weight_bias[m * rows + K_] = this->blobs_[1]->cpu_data()[m];
+      }
+    }
+    weight = weight_bias;
+    col = col_buffer_.mutable_cpu_data();
+    top_buffer = top_buffer_.mutable_cpu_data();
+  } else if (bias_term_) {
+    // The bias is broadcast to every window of the batch by one rank-1 GEMM,
+    // and the window GEMMs accumulate onto it.
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1,
+        (Dtype)1., this->blobs_[1]->cpu_data(), bias_multiplier_.cpu_data(),
+        (Dtype)0., bias_plane_.mutable_cpu_data());
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    if (!batched_gemm_) {
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * group_out_,
+            M_ * N_, 1, (Dtype)1., window_multiplier_.cpu_data(),
+            bias_plane_.cpu_data(), (Dtype)0., top_data);
+      } else {
+        caffe_set((*top)[i]->count(), Dtype(0), top_data);
+      }
+    }
+    Caffe::thread_pool().Run(boost::bind(
+        &TemporalConvolutionLayer<Dtype>::ForwardSamples_cpu, this,
+        bottom[i]->cpu_data(), weight, top_data, col, top_buffer, _1));
   }
 }
 
 template <typename Dtype>
 void TemporalConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
-
-  const Dtype* weight = NULL;
-  Dtype* weight_diff = NULL;
-  if (this->param_propagate_down_[0]) {
-    weight = this->blobs_[0]->cpu_data();
-    weight_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_set(this->blobs_[0]->count(), Dtype(0), weight_diff);
+  if (buffer_threads_ != Caffe::thread_pool().num_threads()) {
+    ReshapeThreadBuffers();
+  }
+  // The batched GEMM computes the weight and bias gradients together, while
+  // the bias gradient of the per-window GEMMs is taken over the whole top.
+  const bool bias_propagate_down = bias_term_ && this->param_propagate_down_[1];
+  Dtype* thread_weight_diff = NULL;
+  if (this->param_propagate_down_[0] ||
+      (batched_gemm_ && bias_propagate_down)) {
+    thread_weight_diff = thread_weight_diff_.mutable_cpu_diff();
+    caffe_set(thread_weight_diff_.count(), Dtype(0), thread_weight_diff);
   }
   Dtype* bias_diff = NULL;
-  if (bias_term_ && this->param_propagate_down_[1]) {
+  if (bias_propagate_down) {
     bias_diff = this->blobs_[1]->mutable_cpu_diff();
     caffe_set(this->blobs_[1]->count(), Dtype(0), bias_diff);
   }
-
-  const int top_offset = num_output_ * N_;
-  int bottom_offset = vl_ * N_;  // number of values in an input region
+  Dtype* col = NULL;
+  Dtype* col_diff = NULL;
+  Dtype* top_buffer_diff = NULL;
+  if (batched_gemm_) {
+    col = col_buffer_.mutable_cpu_data();
+    col_diff = col_buffer_.mutable_cpu_diff();
+    top_buffer_diff = top_buffer_.mutable_cpu_diff();
+  }
+  // The threads read the weight through cpu_data, which only reads once the
+  // weight is on the host.
+  this->blobs_[0]->cpu_data();
 
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->cpu_diff();
-    const Dtype* bottom_data = (*bottom)[i]->cpu_data();
     Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
-    caffe_set(num_*channels_*height_*width_, Dtype(0), bottom_diff);
-    
-    if (this->param_propagate_down_[0] || propagate_down[i] || 
-                    bias_term_ && this->param_propagate_down_[1]) {
-      for (int n = 0; n < num_; ++n) {
-        for (int g = 0; g < group_out_; ++g) {
-
-          int offset_ng = top[i]->offset(n) + top_offset * g;
-          if (bias_term_ && this->param_propagate_down_[1]) {
-            caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
-                1., top_diff + offset_ng,
-                bias_multiplier_.cpu_data(), 1.,
-                bias_diff);
-          }
-          if (this->param_propagate_down_[0] || propagate_down[i]) {
+    caffe_set((*bottom)[i]->count(), Dtype(0), bottom_diff);
 
-            // gradient w.r.t. weight. Note that we will accumulate diffs.
-            if (this->param_propagate_down_[0]) {
-              if (g * stride_ < pad_) {
-                // pad left
-                caffe_set((pad_ - g * stride_) * bottom_offset, Dtype(0), padded_bottom_i_.mutable_cpu_data());
-                caffe_copy((kernel_size_ - pad_ + g * stride_) * bottom_offset, 
-                                bottom_data + (*bottom)[i]->offset(n), 
-                                padded_bottom_i_.mutable_cpu_data() + (pad_ - g * stride_) * bottom_offset);
-                caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                    (Dtype)1., top_diff + offset_ng, padded_bottom_i_.cpu_data(),
-                    (Dtype)1., weight_diff);
-              } else if (g * stride_ + kernel_size_  > pad_ + group_) {
-                // pad right
-                caffe_copy((pad_ + group_ - g * stride_) * bottom_offset, 
-                           bottom_data + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-                           padded_bottom_i_.mutable_cpu_data());
-                caffe_set((kernel_size_ + g * stride_ - pad_ - group_) * bottom_offset, Dtype(0), 
-                           padded_bottom_i_.mutable_cpu_data() + (pad_ + group_ - g * stride_) * bottom_offset);
-                caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                    (Dtype)1., top_diff + offset_ng, padded_bottom_i_.cpu_data(),
-                    (Dtype)1., weight_diff);
-              } else {
-                // no pad
-                caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                    (Dtype)1., top_diff + offset_ng,
-                    bottom_data + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset, (Dtype)1.,
-                    weight_diff);
-              }
-            }
-            // gradient w.r.t. bottom data, if necessary.
-            if (propagate_down[i]) {
-              if (weight == NULL) {
-                weight = this->blobs_[0]->cpu_data();
-              }
-              if (g * stride_ < pad_) {
-                // pad left
-                //caffe_set((pad_ - g * stride_) * bottom_offset, Dtype(0), padded_bottom_i_.mutable_cpu_data());
-                caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                    (Dtype)1., weight,
-                    top_diff + offset_ng,
-                    (Dtype)0., padded_bottom_i_.mutable_cpu_diff());
-                caffe_add((kernel_size_ - pad_ + g * stride_) * bottom_offset, 
-                                (*bottom)[i]->cpu_diff() + (*bottom)[i]->offset(n), 
-                                padded_bottom_i_.cpu_diff() + (pad_ - g * stride_) * bottom_offset,
-                                bottom_diff + (*bottom)[i]->offset(n));
-              } else if (g * stride_ + kernel_size_  > pad_ + group_) {
-                // pad right
-                //caffe_set((kernel_size_ + g * stride_ - pad_ - group_) * bottom_offset, Dtype(0), 
-                //           padded_bottom_i_.mutable_cpu_data() + (pad_ + group_ - g * stride_) * bottom_offset);
-                caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                    (Dtype)1., weight,
-                    top_diff + offset_ng,
-                    (Dtype)0., padded_bottom_i_.mutable_cpu_diff());
-                caffe_add((pad_ + group_ - g * stride_) * bottom_offset, 
-                           (*bottom)[i]->cpu_diff() + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-                           padded_bottom_i_.cpu_diff(),
-                           bottom_diff + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset);
-              } else {
-                //caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                //    (Dtype)1., top_diff + offset_ng,
-                //    bottom_data + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset, (Dtype)1.,
-                //    weight_diff);
-
-                // no pad
-                caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                    (Dtype)1., weight,
-                    top_diff + offset_ng,
-                    (Dtype)1., bottom_diff + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset);
-              }
-            }
-          }
-        }
-      }
+    // gradient w.r.t. bias, summed over all windows of the batch first.
+    if (bias_propagate_down && !batched_gemm_) {
+      caffe_cpu_gemv<Dtype>(CblasTrans, num_ * group_out_, M_ * N_,
+          1., top_diff, window_multiplier_.cpu_data(), 0.,
+          bias_plane_.mutable_cpu_diff());
+      caffe_cpu_gemv<Dtype>(CblasNoTrans, M_, N_,
+          1., bias_plane_.cpu_diff(), bias_multiplier_.cpu_data(), 1.,
+          bias_diff);
+    }
+    if (thread_weight_diff || propagate_down[i]) {
+      Caffe::thread_pool().Run(boost::bind(
+          &TemporalConvolutionLayer<Dtype>::BackwardSamples_cpu, this,
+          top_diff, (*bottom)[i]->cpu_data(),
+          propagate_down[i] ? bottom_diff : NULL, thread_weight_diff,
+          col, col_diff, top_buffer_diff, _1));
+    }
+  }
+  if (!thread_weight_diff) {
+    return;
+  }
+  // Sum the gradients of the threads, and split off the bias column of the
+  // batched GEMM.
+  const int rows = (batched_gemm_ && bias_term_) ? K_ + 1 : K_;
+  const int slice = M_ * rows;
+  for (int t = 1; t < buffer_threads_; ++t) {
+    caffe_axpy(slice, Dtype(1), thread_weight_diff + t * slice,
+        thread_weight_diff);
+  }
+  if (this->param_propagate_down_[0]) {
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    for (int m = 0; m < M_; ++m) {
+      caffe_copy(K_, thread_weight_diff + m * rows, weight_diff + m * K_);
+    }
+  }
+  if (batched_gemm_ && bias_propagate_down) {
+    for (int m = 0; m < M_; ++m) {
+      bias_diff[m] = thread_weight_diff[m * rows + K_];
     }
   }
 }
@@ -11,48 +11,43 @@ namespace caffe {
 template <typename Dtype>
 void TemporalConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  // The bias is broadcast to every window of the batch by one rank-1 GEMM,
+  // and the window GEMMs accumulate onto it.
+  const Dtype beta = bias_term_ ? Dtype(1) : Dtype(0);
+  if (bias_term_) {
+    caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1,
+        (Dtype)1., this->blobs_[1]->gpu_data(), bias_multiplier_.gpu_data(),
+        (Dtype)0., bias_plane_.mutable_gpu_data());
+  }
   for (int i = 0; i < bottom.size(); ++i) {
 
     const Dtype* bottom_data = bottom[i]->gpu_data();
     Dtype* top_data = (*top)[i]->mutable_gpu_data();
     const Dtype* weight = this->blobs_[0]->gpu_data();
+    if (bias_term_) {
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * group_out_,
+          M_ * N_, 1, (Dtype)1., window_multiplier_.gpu_data(),
+          bias_plane_.gpu_data(), (Dtype)0., top_data);
+    } else {
+      caffe_gpu_set((*top)[i]->count(), Dtype(0), top_data);
+    }
 
     int bottom_offset = vl_ * N_;  // number of values in an input region
     int top_offset = num_output_ * N_;  // number of values in an output region / column
 
     for (int n = 0; n < num_; ++n) {
       for (int g = 0; g < group_out_; ++g) {
-        if (g * stride_ < pad_) {
-          // pad left
-          caffe_gpu_set((pad_ - g * stride_) * bottom_offset, Dtype(0), padded_bottom_i_.mutable_gpu_data());
-          caffe_copy((kernel_size_ - pad_ + g * stride_) * vl_ * N_, 
-                          bottom_data + bottom[i]->offset(n), 
-                          padded_bottom_i_.mutable_gpu_data() + (pad_ - g * stride_) * bottom_offset);
-          caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-              (Dtype)1., weight, padded_bottom_i_.gpu_data(),
-              (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
-        } else if (g * stride_ + kernel_size_  > pad_ + group_) {
-          // pad right
-          caffe_copy((pad_ + group_ - g * stride_) * bottom_offset, 
-                     bottom_data + bottom[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-                     padded_bottom_i_.mutable_gpu_data());
-          caffe_gpu_set((kernel_size_ + g * stride_ - pad_ - group_) * bottom_offset, Dtype(0), 
-                     padded_bottom_i_.mutable_gpu_data() + (pad_ + group_ - g * stride_) * bottom_offset);
-          caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-              (Dtype)1., weight, padded_bottom_i_.gpu_data(),
-              (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
-        } else {
-          // no pad
-          caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-              (Dtype)1., weight, bottom_data + bottom[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-              (Dtype)0., top_data + (*top)[i]->offset(n) + top_offset * g);
-        }
-        if (bias_term_) {
-          caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, 
-              N_, 1, (Dtype)1., this->blobs_[1]->gpu_data(),
-              bias_multiplier_.gpu_data(),
-              (Dtype)1., top_data + (*top)[i]->offset(n) + top_offset * g);
+        // Only the taps inside the input take part; see Forward_cpu.
+        int first, last;
+        ValidTaps(g, &first, &last);
+        if (first >= last) {
+          continue;
         }
+        caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_,
+            (last - first) * vl_, (Dtype)1., weight + first * vl_, K_,
+            bottom_data + bottom[i]->offset(n)
+                + (g * stride_ - pad_ + first) * bottom_offset, N_,
+            beta, top_data + (*top)[i]->offset(n) + top_offset * g, N_);
       }
     }
 
@@ -84,83 +79,47 @@ void TemporalConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& t
     const Dtype* bottom_data = (*bottom)[i]->gpu_data();
     Dtype* bottom_diff = (*bottom)[i]->mutable_gpu_diff();
     caffe_gpu_set(num_*channels_*height_*width_, Dtype(0), bottom_diff);
+
+    // gradient w.r.t. bias, summed over all windows of the batch first.
+    if (bias_term_ && this->param_propagate_down_[1]) {
+      caffe_gpu_gemv<Dtype>(CblasTrans, num_ * group_out_, M_ * N_,
+          1., top_diff, window_multiplier_.gpu_data(), 0.,
+          bias_plane_.mutable_gpu_diff());
+      caffe_gpu_gemv<Dtype>(CblasNoTrans, M_, N_,
+          1., bias_plane_.gpu_diff(), bias_multiplier_.gpu_data(), 1.,
+          bias_diff);
+    }
     
-    if (this->param_propagate_down_[0] || propagate_down[i] || 
-                    bias_term_ && this->param_propagate_down_[1]) {
+    if (this->param_propagate_down_[0] || propagate_down[i]) {
       for (int n = 0; n < num_; ++n) {
         for (int g = 0; g < group_out_; ++g) {
 
           int offset_ng = top[i]->offset(n) + top_offset * g;
-          if (bias_term_ && this->param_propagate_down_[1]) {
-            caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
-                1., top_diff + offset_ng,
-                bias_multiplier_.gpu_data(), 1.,
-                bias_diff);
+          int first, last;
+          ValidTaps(g, &first, &last);
+          if (first >= last) {
+            continue;
           }
-          if (this->param_propagate_down_[0] || propagate_down[i]) {
-
-            // gradient w.r.t. weight. Note that we will accumulate diffs.
-            if (this->param_propagate_down_[0]) {
-              if (g * stride_ < pad_) {
-                // pad left
-                caffe_gpu_set((pad_ - g * stride_) * bottom_offset, Dtype(0), padded_bottom_i_.mutable_gpu_data());
-                caffe_copy((kernel_size_ - pad_ + g * stride_) * bottom_offset, 
-                                bottom_data + (*bottom)[i]->offset(n), 
-                                padded_bottom_i_.mutable_gpu_data() + (pad_ - g * stride_) * bottom_offset);
-                caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                    (Dtype)1., top_diff + offset_ng, padded_bottom_i_.gpu_data(),
-                    (Dtype)1., weight_diff);
-              } else if (g * stride_ + kernel_size_  > pad_ + group_) {
-                // pad right
-                caffe_copy((pad_ + group_ - g * stride_) * bottom_offset, 
-                           bottom_data + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-                           padded_bottom_i_.mutable_gpu_data());
-                caffe_gpu_set((kernel_size_ + g * stride_ - pad_ - group_) * bottom_offset, Dtype(0), 
-                           padded_bottom_i_.mutable_gpu_data() + (pad_ + group_ - g * stride_) * bottom_offset);
-                caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                    (Dtype)1., top_diff + offset_ng, padded_bottom_i_.gpu_data(),
-                    (Dtype)1., weight_diff);
-              } else {
-                // no pad
-                caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                    (Dtype)1., top_diff + offset_ng,
-                    bottom_data + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset, (Dtype)1.,
-                    weight_diff);
-              }
-            }
-            // gradient w.r.t. bottom data, if necessary.
-            if (propagate_down[i]) {
-              if (weight == NULL) {
-                weight = this->blobs_[0]->gpu_data();
-              }
-              if (g * stride_ < pad_) {
-                // pad left
-                caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                    (Dtype)1., weight,
-                    top_diff + offset_ng,
-                    (Dtype)0., padded_bottom_i_.mutable_gpu_diff());
-                caffe_gpu_add((kernel_size_ - pad_ + g * stride_) * bottom_offset, 
-                                (*bottom)[i]->gpu_diff() + (*bottom)[i]->offset(n), 
-                                padded_bottom_i_.gpu_diff() + (pad_ - g * stride_) * bottom_offset,
-                                bottom_diff + (*bottom)[i]->offset(n));
-              } else if (g * stride_ + kernel_size_  > pad_ + group_) {
-                // pad right
-                caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                    (Dtype)1., weight,
-                    top_diff + offset_ng,
-                    (Dtype)0., padded_bottom_i_.mutable_gpu_diff());
-                caffe_gpu_add((pad_ + group_ - g * stride_) * bottom_offset, 
-                           (*bottom)[i]->gpu_diff() + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset,
-                           padded_bottom_i_.gpu_diff(),
-                           bottom_diff + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset);
-              } else {
-                // no pad
-                caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
-                    (Dtype)1., weight,
-                    top_diff + offset_ng,
-                    (Dtype)1., bottom_diff + (*bottom)[i]->offset(n) + (g * stride_ - pad_) * bottom_offset);
-              }
+          const int k = (last - first) * vl_;
+          const int offset_frames = (*bottom)[i]->offset(n)
+              + (g * stride_ - pad_ + first) * bottom_offset;
+
+          // gradient w.r.t. weight. Note that we will accumulate diffs.
+          if (this->param_propagate_down_[0]) {
+            caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, k, N_,
+                (Dtype)1., top_diff + offset_ng, N_,
+                bottom_data + offset_frames, N_,
+                (Dtype)1., weight_diff + first * vl_, K_);
+          }
+          // gradient w.r.t. bottom data, if necessary.
+          if (propagate_down[i]) {
+            if (weight == NULL) {
+              weight = this->blobs_[0]->gpu_data();
             }
+            caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, k, N_, M_,
+                (Dtype)1., weight + first * vl_, K_,
+                top_diff + offset_ng, N_,
+                (Dtype)1., bottom_diff + offset_frames, N_);
           }
         }
       }
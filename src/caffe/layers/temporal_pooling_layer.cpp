@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <cfloat>
 #include <vector>
@@ -6,6 +8,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -39,11 +42,13 @@ void TemporalPoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
         << "Padding implemented only for average and max pooling.";
     CHECK_LT(pad_, kernel_size_);
   }
+  max_idx_valid_ = false;
 }
 
 template <typename Dtype>
 void TemporalPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  num_ = bottom[0]->num();
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
@@ -67,6 +72,7 @@ void TemporalPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       TemporalPoolingParameter_PoolMethod_MAX) {
     max_idx_.Reshape(bottom[0]->num(), pooled_length_ * vl_, height_, width_);
   }
+  ReshapeThreadBuffers();
   // If stochastic pooling, we will initialize the random index part.
   //if (this->layer_param_.temporal_pooling_param().pool() ==
   //    TemporalPoolingParameter_PoolMethod_STOCHASTIC) {
@@ -74,6 +80,335 @@ void TemporalPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   //}
 }
 
+template <typename Dtype>
+void TemporalPoolingLayer<Dtype>::ReshapeThreadBuffers() {
+  // The samples of the batch are split over the threads of the CPU pool.
+  // Overlapping windows go through the block maxima of SlidingMax_cpu or the
+  // running sums of the AVE pooling, which need a scratch sample per thread;
+  // otherwise the samples need no scratch at all.
+  buffer_threads_ = Caffe::thread_pool().num_threads();
+  if (kernel_size_ <= stride_) {
+    return;
+  }
+  switch (this->layer_param_.temporal_pooling_param().pool()) {
+  case TemporalPoolingParameter_PoolMethod_MAX:
+    block_max_.Reshape(buffer_threads_, 2, group_, K_);
+    block_max_idx_.Reshape(buffer_threads_, 2, group_, K_);
+    break;
+  case TemporalPoolingParameter_PoolMethod_AVE:
+    running_sum_.Reshape(buffer_threads_, 1, group_ + 1, K_);
+    break;
+  default:
+    break;
+  }
+}
+
+// The first and one past the last frame of output g, clipped to the input,
+// and the number of frames it averages over, which counts the padding.
+template <typename Dtype>
+inline void TemporalPoolingLayer<Dtype>::Window(const int g, int* start,
+      int* end, int* pool_size) const {
+  *start = g * stride_ - pad_;
+  *end = min(*start + kernel_size_, group_ + pad_);
+  *pool_size = *end - *start;
+  *start = max(*start, 0);
+  *end = min(*end, group_);
+}
+
+template <typename Dtype>
+void TemporalPoolingLayer<Dtype>::ForwardMax_cpu(const Dtype* bottom_data,
+      Dtype* top_data, int* mask, Dtype* block_max, int* block_max_idx,
+      const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  const int offset = K_;
+  const int bottom_sample = group_ * K_;
+  const int top_sample = pooled_length_ * K_;
+  if (kernel_size_ > stride_) {
+    block_max += block_max_.offset(thread_id);
+    block_max_idx += block_max_idx_.offset(thread_id);
+    for (int n = begin; n < end; ++n) {
+      SlidingMax_cpu(bottom_data + n * bottom_sample,
+          top_data + n * top_sample, mask ? mask + n * top_sample : NULL,
+          block_max, block_max_idx);
+    }
+    return;
+  }
+  if (!mask) {
+    // Inference: no frame indices to keep, so start from the first frame.
+    for (int n = begin; n < end; ++n) {
+      for (int g = 0; g < pooled_length_; ++g) {
+        int start, stop, pool_size;
+        Window(g, &start, &stop, &pool_size);
+        Dtype* top = top_data + n * top_sample + g * K_;
+        const Dtype* x = bottom_data + n * bottom_sample + start * K_;
+        caffe_copy(K_, x, top);
+        for (int t = start + 1; t < stop; ++t) {
+          x += K_;
+          for (int i = 0; i < K_; ++i) {
+            top[i] = x[i] > top[i] ? x[i] : top[i];
+          }
+        }
+      }
+    }
+    return;
+  }
+  caffe_set((end - begin) * top_sample, -1, mask + begin * top_sample);
+  caffe_set((end - begin) * top_sample, Dtype(-FLT_MAX),
+      top_data + begin * top_sample);
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < pooled_length_; g++) {
+      int offset_ng = n * top_sample + offset * g;
+      if (g * stride_ < pad_) {
+        int valid_count = kernel_size_ - pad_ + g * stride_;  // last #valid_count input inside the kernel_size
+        for (int index = 0; index < valid_count; index ++) {
+          caffe_cpu_vimax(offset, top_data + offset_ng, mask + offset_ng, 
+                          bottom_data + n * bottom_sample + index * offset, 
+                          index);
+        }
+      } else {
+        int valid_count = min(kernel_size_, pad_ + group_ - g * stride_);  
+        for (int index = 0; index < valid_count; index++) {
+          caffe_cpu_vimax(offset, top_data + offset_ng, mask + offset_ng, 
+                          bottom_data + n * bottom_sample + (g * stride_ - pad_ + index) * offset, 
+                          index);
+        }
+      }
+    }
+  }
+}
+
+// van Herk/Gil-Werman max filter along time: the frames are cut into blocks of
+// kernel_size_, and every frame keeps the max from the start of its block up
+// to it (prefix) and from it to the end of its block (suffix). A window of
+// kernel_size_ frames is the suffix of one block followed by the prefix of the
+// next, so each output costs one compare whatever kernel_size_ is. The windows
+// clipped by the padding start at frame 0, the start of a block, or end at the
+// last frame, the end of a (short) block, so they are covered as well.
+// The ties go to the earliest frame and the mask holds the frame relative to
+// the clipped window start, exactly as with caffe_cpu_vimax. Without a mask
+// the frames are not tracked at all.
+template <typename Dtype>
+void TemporalPoolingLayer<Dtype>::SlidingMax_cpu(const Dtype* bottom_data,
+      Dtype* top_data, int* mask, Dtype* block_max, int* block_max_idx) {
+  Dtype* prefix = block_max;
+  Dtype* suffix = block_max + group_ * K_;
+  int* prefix_idx = block_max_idx;
+  int* suffix_idx = block_max_idx + group_ * K_;
+  for (int t = 0; t < group_; ++t) {
+    const Dtype* x = bottom_data + t * K_;
+    Dtype* p = prefix + t * K_;
+    int* p_idx = prefix_idx + t * K_;
+    if (t % kernel_size_ == 0) {
+      caffe_copy(K_, x, p);
+      if (mask) {
+        caffe_set(K_, t, p_idx);
+      }
+      continue;
+    }
+    const Dtype* p_prev = p - K_;
+    const int* p_idx_prev = p_idx - K_;
+    if (!mask) {
+      for (int i = 0; i < K_; ++i) {
+        p[i] = x[i] > p_prev[i] ? x[i] : p_prev[i];
+      }
+      continue;
+    }
+    for (int i = 0; i < K_; ++i) {
+      const bool take = x[i] > p_prev[i];
+      p[i] = take ? x[i] : p_prev[i];
+      p_idx[i] = take ? t : p_idx_prev[i];
+    }
+  }
+  for (int t = group_ - 1; t >= 0; --t) {
+    const Dtype* x = bottom_data + t * K_;
+    Dtype* s = suffix + t * K_;
+    int* s_idx = suffix_idx + t * K_;
+    if (t == group_ - 1 || (t + 1) % kernel_size_ == 0) {
+      caffe_copy(K_, x, s);
+      if (mask) {
+        caffe_set(K_, t, s_idx);
+      }
+      continue;
+    }
+    const Dtype* s_next = s + K_;
+    const int* s_idx_next = s_idx + K_;
+    if (!mask) {
+      for (int i = 0; i < K_; ++i) {
+        s[i] = x[i] >= s_next[i] ? x[i] : s_next[i];
+      }
+      continue;
+    }
+    for (int i = 0; i < K_; ++i) {
+      const bool take = x[i] >= s_next[i];
+      s[i] = take ? x[i] : s_next[i];
+      s_idx[i] = take ? t : s_idx_next[i];
+    }
+  }
+  for (int g = 0; g < pooled_length_; ++g) {
+    const int start = max(g * stride_ - pad_, 0);
+    const int last = min(g * stride_ - pad_ + kernel_size_, group_) - 1;
+    Dtype* top = top_data + g * K_;
+    if (start / kernel_size_ == last / kernel_size_) {
+      // A single block: the window is a prefix of it, or ends the input.
+      const bool use_prefix = start % kernel_size_ == 0;
+      const Dtype* m = use_prefix ? prefix + last * K_ : suffix + start * K_;
+      caffe_copy(K_, m, top);
+      if (mask) {
+        const int* m_idx = use_prefix ? prefix_idx + last * K_ :
+            suffix_idx + start * K_;
+        int* top_mask = mask + g * K_;
+        for (int i = 0; i < K_; ++i) {
+          top_mask[i] = m_idx[i] - start;
+        }
+      }
+      continue;
+    }
+    const Dtype* s = suffix + start * K_;
+    const Dtype* p = prefix + last * K_;
+    if (!mask) {
+      for (int i = 0; i < K_; ++i) {
+        top[i] = s[i] >= p[i] ? s[i] : p[i];
+      }
+      continue;
+    }
+    const int* s_idx = suffix_idx + start * K_;
+    const int* p_idx = prefix_idx + last * K_;
+    int* top_mask = mask + g * K_;
+    for (int i = 0; i < K_; ++i) {
+      const bool take = s[i] >= p[i];
+      top[i] = take ? s[i] : p[i];
+      top_mask[i] = (take ? s_idx[i] : p_idx[i]) - start;
+    }
+  }
+}
+
+template <typename Dtype>
+void TemporalPoolingLayer<Dtype>::BackwardMax_cpu(const Dtype* top_diff,
+      const int* mask, Dtype* bottom_diff, const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  const int offset = K_;
+  const int bottom_sample = group_ * K_;
+  const int top_sample = pooled_length_ * K_;
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < pooled_length_; g++) {
+      int offset_ng = n * top_sample + offset * g;
+      if (g * stride_ < pad_) {
+        caffe_cpu_backfill(offset, top_diff + offset_ng, mask + offset_ng, 
+                          bottom_diff + n * bottom_sample, true);
+      } else {
+        caffe_cpu_backfill(offset, top_diff + offset_ng, mask + offset_ng, 
+                          bottom_diff + n * bottom_sample + (g * stride_ - pad_) * offset, true);
+      }
+    }
+  }
+}
+
+// Overlapping windows are differences of running sums along time, so each
+// output costs one subtraction whatever kernel_size_ is; the others simply
+// add up their frames, each of which they read once.
+template <typename Dtype>
+void TemporalPoolingLayer<Dtype>::ForwardAve_cpu(const Dtype* bottom_data,
+      Dtype* top_data, Dtype* running_sum, const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  const int bottom_sample = group_ * K_;
+  const int top_sample = pooled_length_ * K_;
+  if (running_sum) {
+    running_sum += running_sum_.offset(thread_id);
+  }
+  for (int n = begin; n < end; ++n) {
+    const Dtype* x = bottom_data + n * bottom_sample;
+    if (running_sum) {
+      // running_sum[t] is the sum of frames [0, t).
+      caffe_set(K_, Dtype(0), running_sum);
+      for (int t = 0; t < group_; ++t) {
+        const Dtype* sum = running_sum + t * K_;
+        const Dtype* x_t = x + t * K_;
+        Dtype* next = running_sum + (t + 1) * K_;
+        for (int i = 0; i < K_; ++i) {
+          next[i] = sum[i] + x_t[i];
+        }
+      }
+    }
+    for (int g = 0; g < pooled_length_; ++g) {
+      int start, stop, pool_size;
+      Window(g, &start, &stop, &pool_size);
+      const Dtype scale = Dtype(1) / pool_size;
+      Dtype* top = top_data + n * top_sample + g * K_;
+      if (running_sum) {
+        const Dtype* sum_start = running_sum + start * K_;
+        const Dtype* sum_stop = running_sum + stop * K_;
+        for (int i = 0; i < K_; ++i) {
+          top[i] = (sum_stop[i] - sum_start[i]) * scale;
+        }
+        continue;
+      }
+      caffe_copy(K_, x + start * K_, top);
+      for (int t = start + 1; t < stop; ++t) {
+        const Dtype* x_t = x + t * K_;
+        for (int i = 0; i < K_; ++i) {
+          top[i] += x_t[i];
+        }
+      }
+      caffe_scal(K_, scale, top);
+    }
+  }
+}
+
+// The gradient of a frame is the sum of top_diff / pool_size over the windows
+// that hold it. For overlapping windows each one adds its share at its start
+// and takes it back at its end, and a running sum over the frames yields the
+// gradients, again whatever kernel_size_ is.
+template <typename Dtype>
+void TemporalPoolingLayer<Dtype>::BackwardAve_cpu(const Dtype* top_diff,
+      Dtype* bottom_diff, Dtype* running_sum, const int thread_id) {
+  int begin, end;
+  ThreadRange(num_, thread_id, buffer_threads_, &begin, &end);
+  const int bottom_sample = group_ * K_;
+  const int top_sample = pooled_length_ * K_;
+  if (running_sum) {
+    running_sum += running_sum_.offset(thread_id);
+  }
+  for (int n = begin; n < end; ++n) {
+    Dtype* x_diff = bottom_diff + n * bottom_sample;
+    if (running_sum) {
+      caffe_set((group_ + 1) * K_, Dtype(0), running_sum);
+    }
+    for (int g = 0; g < pooled_length_; ++g) {
+      int start, stop, pool_size;
+      Window(g, &start, &stop, &pool_size);
+      const Dtype scale = Dtype(1) / pool_size;
+      const Dtype* top = top_diff + n * top_sample + g * K_;
+      if (running_sum) {
+        Dtype* delta_start = running_sum + start * K_;
+        Dtype* delta_stop = running_sum + stop * K_;
+        for (int i = 0; i < K_; ++i) {
+          const Dtype share = top[i] * scale;
+          delta_start[i] += share;
+          delta_stop[i] -= share;
+        }
+        continue;
+      }
+      for (int t = start; t < stop; ++t) {
+        caffe_axpy(K_, scale, top, x_diff + t * K_);
+      }
+    }
+    if (running_sum) {
+      caffe_copy(K_, running_sum, x_diff);
+      for (int t = 1; t < group_; ++t) {
+        const Dtype* prev = x_diff + (t - 1) * K_;
+        const Dtype* delta = running_sum + t * K_;
+        Dtype* x_t = x_diff + t * K_;
+        for (int i = 0; i < K_; ++i) {
+          x_t[i] = prev[i] + delta[i];
+        }
+      }
+    }
+  }
+}
+
 // TODO(Yangqing): Is there a faster way to do pooling in the channel-first
 // case?
 template <typename Dtype>
@@ -81,87 +416,40 @@ void TemporalPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom
       vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  const int top_count = (*top)[0]->count();
   // We'll output the mask to top[1] if it's of size >1.
   //const bool use_top_mask = top->size() > 1;
   int* mask = NULL;  // suppress warnings about uninitalized variables
+  Dtype* block_max = NULL;
+  int* block_max_idx = NULL;
+  Dtype* running_sum = NULL;
   //Dtype* top_mask = NULL;
-  int offset = vl_ * width_ * height_;
+  if (buffer_threads_ != Caffe::thread_pool().num_threads()) {
+    ReshapeThreadBuffers();
+  }
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
   switch (this->layer_param_.temporal_pooling_param().pool()) {
   case TemporalPoolingParameter_PoolMethod_MAX:
-    // Initialize
-    //if (use_top_mask) {
-    //  top_mask = (*top)[1]->mutable_cpu_data();
-    //  caffe_set(top_count, Dtype(-1), top_mask);
-    //} else {
-    mask = max_idx_.mutable_cpu_data();
-    caffe_set(top_count, -1, mask);
-    //}
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int g = 0; g < pooled_length_; g++) {
-        int offset_ng = (*top)[0]->offset(n) + offset * g;
-        if (g * stride_ < pad_) {
-          int valid_count = kernel_size_ - pad_ + g * stride_;  // last #valid_count input inside the kernel_size
-          for (int index = 0; index < valid_count; index ++) {
-            caffe_cpu_vimax(offset, top_data + offset_ng, mask + offset_ng, 
-                            bottom_data + bottom[0]->offset(n) + index * offset, 
-                            index);
-          }
-        //} else if (g * stride_ + kernel_size- > pad_ + group_) {
-        //  int valid_count = pad_ + group_ - g * stride_;  // first #valid_count input inside the kernel_size
-        //  for (int index = 0; index < valid_count; index++) {
-        //    caffe_cpu_vimax(offset, top_data + offset_ng, mask + offset_ng, 
-        //                    bottom_data + bottom[0]->offset(n) + (g * stride_ - pad_ + index) * offset, 
-        //                    index);
-        //  }
-        } else {
-          int valid_count = min(kernel_size_, pad_ + group_ - g * stride_);  
-          for (int index = 0; index < valid_count; index++) {
-            caffe_cpu_vimax(offset, top_data + offset_ng, mask + offset_ng, 
-                            bottom_data + bottom[0]->offset(n) + (g * stride_ - pad_ + index) * offset, 
-                            index);
-          }
-        }
-      }
+    // The mask is only needed by Backward, so TEST skips it.
+    max_idx_valid_ = Caffe::phase() == Caffe::TRAIN;
+    if (max_idx_valid_) {
+      mask = max_idx_.mutable_cpu_data();
     }
+    if (kernel_size_ > stride_) {
+      block_max = block_max_.mutable_cpu_data();
+      block_max_idx = block_max_idx_.mutable_cpu_data();
+    }
+    Caffe::thread_pool().Run(boost::bind(
+        &TemporalPoolingLayer<Dtype>::ForwardMax_cpu, this, bottom_data,
+        top_data, mask, block_max, block_max_idx, _1));
     break;
   case TemporalPoolingParameter_PoolMethod_AVE:
-    //for (int i = 0; i < top_count; ++i) {
-    //  top_data[i] = 0;
-    //}
-    //// The main loop
-    //for (int n = 0; n < bottom[0]->num(); ++n) {
-    //  for (int c = 0; c < channels_; ++c) {
-    //    for (int ph = 0; ph < pooled_height_; ++ph) {
-    //      for (int pw = 0; pw < pooled_width_; ++pw) {
-    //        int hstart = ph * stride_h_ - pad_h_;
-    //        int wstart = pw * stride_w_ - pad_w_;
-    //        int hend = min(hstart + kernel_h_, height_ + pad_h_);
-    //        int wend = min(wstart + kernel_w_, width_ + pad_w_);
-    //        int pool_size = (hend - hstart) * (wend - wstart);
-    //        hstart = max(hstart, 0);
-    //        wstart = max(wstart, 0);
-    //        hend = min(hend, height_);
-    //        wend = min(wend, width_);
-    //        for (int h = hstart; h < hend; ++h) {
-    //          for (int w = wstart; w < wend; ++w) {
-    //            top_data[ph * pooled_width_ + pw] +=
-    //                bottom_data[h * width_ + w];
-    //          }
-    //        }
-    //        top_data[ph * pooled_width_ + pw] /= pool_size;
-    //      }
-    //    }
-    //    // compute offset
-    //    bottom_data += bottom[0]->offset(0, 1);
-    //    top_data += (*top)[0]->offset(0, 1);
-    //  }
-    //}
-    NOT_IMPLEMENTED;
+    if (kernel_size_ > stride_) {
+      running_sum = running_sum_.mutable_cpu_data();
+    }
+    Caffe::thread_pool().Run(boost::bind(
+        &TemporalPoolingLayer<Dtype>::ForwardAve_cpu, this, bottom_data,
+        top_data, running_sum, _1));
     break;
   case TemporalPoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -185,58 +473,41 @@ void TemporalPoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   // We'll output the mask to top[1] if it's of size >1.
   //const bool use_top_mask = top.size() > 1;
   const int* mask = NULL;  // suppress warnings about uninitialized variables
-  int offset = vl_ * width_ * height_;
+  Dtype* running_sum = NULL;
   //const Dtype* top_mask = NULL;
+  if (buffer_threads_ != Caffe::thread_pool().num_threads()) {
+    ReshapeThreadBuffers();
+  }
   switch (this->layer_param_.temporal_pooling_param().pool()) {
   case TemporalPoolingParameter_PoolMethod_MAX:
-    // The main loop
-    //if (use_top_mask) {
-    //  top_mask = top[1]->cpu_data();
-    //} else {
-    mask = max_idx_.cpu_data();
-    //}
-    for (int n = 0; n < (*bottom)[0]->num(); ++n) {
-      for (int g = 0; g < pooled_length_; g++) {
-        int offset_ng = top[0]->offset(n) + offset * g;
-        if (g * stride_ < pad_) {
-          caffe_cpu_backfill(offset, top_diff + offset_ng, mask + offset_ng, 
-                            bottom_diff + (*bottom)[0]->offset(n), true);
-        } else {
-          caffe_cpu_backfill(offset, top_diff + offset_ng, mask + offset_ng, 
-                            bottom_diff + (*bottom)[0]->offset(n) + (g * stride_ - pad_) * offset, true);
-        }
+    if (!max_idx_valid_) {
+      // A TEST Forward skipped the mask: pool again to fill it, without
+      // touching the top.
+      mask_top_.ReshapeLike(*top[0]);
+      Dtype* block_max = NULL;
+      int* block_max_idx = NULL;
+      if (kernel_size_ > stride_) {
+        block_max = block_max_.mutable_cpu_data();
+        block_max_idx = block_max_idx_.mutable_cpu_data();
       }
+      Caffe::thread_pool().Run(boost::bind(
+          &TemporalPoolingLayer<Dtype>::ForwardMax_cpu, this,
+          (*bottom)[0]->cpu_data(), mask_top_.mutable_cpu_data(),
+          max_idx_.mutable_cpu_data(), block_max, block_max_idx, _1));
+      max_idx_valid_ = true;
     }
+    mask = max_idx_.cpu_data();
+    Caffe::thread_pool().Run(boost::bind(
+        &TemporalPoolingLayer<Dtype>::BackwardMax_cpu, this, top_diff,
+        mask, bottom_diff, _1));
     break;
   case TemporalPoolingParameter_PoolMethod_AVE:
-    // The main loop
-    //for (int n = 0; n < top[0]->num(); ++n) {
-    //  for (int c = 0; c < channels_; ++c) {
-    //    for (int ph = 0; ph < pooled_height_; ++ph) {
-    //      for (int pw = 0; pw < pooled_width_; ++pw) {
-    //        int hstart = ph * stride_h_ - pad_h_;
-    //        int wstart = pw * stride_w_ - pad_w_;
-    //        int hend = min(hstart + kernel_h_, height_ + pad_h_);
-    //        int wend = min(wstart + kernel_w_, width_ + pad_w_);
-    //        int pool_size = (hend - hstart) * (wend - wstart);
-    //        hstart = max(hstart, 0);
-    //        wstart = max(wstart, 0);
-    //        hend = min(hend, height_);
-    //        wend = min(wend, width_);
-    //        for (int h = hstart; h < hend; ++h) {
-    //          for (int w = wstart; w < wend; ++w) {
-    //            bottom_diff[h * width_ + w] +=
-    //              top_diff[ph * pooled_width_ + pw] / pool_size;
-    //          }
-    //        }
-    //      }
-    //    }
-    //    // offset
-    //    bottom_diff += (*bottom)[0]->offset(0, 1);
-    //    top_diff += top[0]->offset(0, 1);
-    //  }
-    //}
-    NOT_IMPLEMENTED;
+    if (kernel_size_ > stride_) {
+      running_sum = running_sum_.mutable_cpu_data();
+    }
+    Caffe::thread_pool().Run(boost::bind(
+        &TemporalPoolingLayer<Dtype>::BackwardAve_cpu, this, top_diff,
+        bottom_diff, running_sum, _1));
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -13,6 +13,51 @@ namespace caffe {
 using std::min;
 using std::max;
 
+template <typename Dtype>
+__global__ void TemporalAvePoolForward(const int nthreads,
+    const Dtype* bottom_data, const int group, const int pooled_length,
+    const int K, const int kernel_size, const int stride, const int pad,
+    Dtype* top_data) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    int k = index % K;
+    int g = (index / K) % pooled_length;
+    int n = index / K / pooled_length;
+    int start = g * stride - pad;
+    int end = min(start + kernel_size, group + pad);
+    int pool_size = end - start;
+    start = max(start, 0);
+    end = min(end, group);
+    Dtype aveval = 0;
+    bottom_data += n * group * K + k;
+    for (int t = start; t < end; ++t) {
+      aveval += bottom_data[t * K];
+    }
+    top_data[index] = aveval / pool_size;
+  }
+}
+
+template <typename Dtype>
+__global__ void TemporalAvePoolBackward(const int nthreads,
+    const Dtype* top_diff, const int group, const int pooled_length,
+    const int K, const int kernel_size, const int stride, const int pad,
+    Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    int k = index % K;
+    int t = (index / K) % group + pad;
+    int n = index / K / group;
+    int gstart = (t < kernel_size) ? 0 : (t - kernel_size) / stride + 1;
+    int gend = min(t / stride + 1, pooled_length);
+    Dtype gradient = 0;
+    top_diff += n * pooled_length * K + k;
+    for (int g = gstart; g < gend; ++g) {
+      int start = g * stride - pad;
+      int end = min(start + kernel_size, group + pad);
+      gradient += top_diff[g * K] / (end - start);
+    }
+    bottom_diff[index] = gradient;
+  }
+}
+
 template <typename Dtype>
 void TemporalPoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -29,6 +74,7 @@ void TemporalPoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom
   switch (this->layer_param_.temporal_pooling_param().pool()) {
   case TemporalPoolingParameter_PoolMethod_MAX:
     // Initialize
+    max_idx_valid_ = true;
     mask = max_idx_.mutable_gpu_data();
     caffe_gpu_set(top_count, -1, mask);
     caffe_gpu_set(top_count, Dtype(-FLT_MAX), top_data);
@@ -55,7 +101,12 @@ void TemporalPoolingLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom
     }
     break;
   case TemporalPoolingParameter_PoolMethod_AVE:
-    NOT_IMPLEMENTED;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    TemporalAvePoolForward<Dtype><<<CAFFE_GET_BLOCKS(top_count),
+                                    CAFFE_CUDA_NUM_THREADS>>>(
+        top_count, bottom_data, group_, pooled_length_, K_, kernel_size_,
+        stride_, pad_, top_data);
+    CUDA_POST_KERNEL_CHECK;
     break;
   case TemporalPoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -103,7 +154,12 @@ void TemporalPoolingLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     }
     break;
   case TemporalPoolingParameter_PoolMethod_AVE:
-    NOT_IMPLEMENTED;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    TemporalAvePoolBackward<Dtype><<<CAFFE_GET_BLOCKS((*bottom)[0]->count()),
+                                     CAFFE_CUDA_NUM_THREADS>>>(
+        (*bottom)[0]->count(), top_diff, group_, pooled_length_, K_,
+        kernel_size_, stride_, pad_, bottom_diff);
+    CUDA_POST_KERNEL_CHECK;
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
     NOT_IMPLEMENTED;
@@ -0,0 +1,282 @@
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <iostream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/data_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/video_io.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+VideoDataLayer<Dtype>::~VideoDataLayer<Dtype>() {
+  this->StopPrefetchThread();
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const VideoDataParameter& video_data_param =
+      this->layer_param_.video_data_param();
+  const int new_height = video_data_param.new_height();
+  const int new_width  = video_data_param.new_width();
+  CHECK((new_height == 0 && new_width == 0) ||
+      (new_height > 0 && new_width > 0)) << "Current implementation requires "
+      "new_height and new_width to be set at the same time.";
+  CHECK(this->layer_param_.transform_param().is_video())
+      << "VideoDataLayer requires transform_param.is_video to be set.";
+  const int crop_frames = this->layer_param_.transform_param().video_crop_size_t();
+  CHECK_GT(crop_frames, 0) << "Video_crop_size_t must be set.";
+  // in any phase, as the layer may run in another phase than it is set up in
+  const TransformationParameter& transform_param =
+      this->layer_param_.transform_param();
+  CHECK(transform_param.clips_per_sample() == 1 &&
+        transform_param.test_crops() == 1 && !transform_param.test_mirror())
+      << "VideoDataLayer samples one window per video";
+  // Read the file with filenames and labels
+  const string& source = video_data_param.source();
+  CHECK_GT(source.size(), 0);
+  LOG(INFO) << "Opening file " << source;
+  std::ifstream infile(source.c_str());
+  CHECK(infile.good())
+      << "Could not open video list (filename: \""+ source + "\")";
+  const string& root_folder = video_data_param.root_folder();
+  string filename;
+  int label;
+  while (infile >> filename >> label) {
+    lines_.push_back(std::make_pair(root_folder + filename, label));
+  }
+  CHECK(!lines_.empty())
+      << "Video list is empty (filename: \"" + source + "\")";
+
+  // The rng also samples the temporal windows, so it is always needed.
+  const unsigned int prefetch_rng_seed = caffe_rng_rand();
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  if (video_data_param.shuffle()) {
+    // randomly shuffle data
+    LOG(INFO) << "Shuffling data";
+    ShuffleVideos();
+  }
+  LOG(INFO) << "A total of " << lines_.size() << " videos.";
+
+  lines_id_ = 0;
+  // Check if we would need to randomly skip a few data points
+  if (video_data_param.rand_skip()) {
+    unsigned int skip = caffe_rng_rand() % video_data_param.rand_skip();
+    LOG(INFO) << "Skipping first " << skip << " data points.";
+    CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
+    lines_id_ = skip;
+  }
+  const int batch_size = video_data_param.batch_size();
+  CHECK_GT(video_data_param.decode_threads(), 0);
+  readers_.clear();
+  for (int i = 0; i < video_data_param.decode_threads(); ++i) {
+    readers_.push_back(shared_ptr<DatumVideoReader>(new DatumVideoReader()));
+  }
+  decode_pool_.reset(new ThreadPool(video_data_param.decode_threads()));
+  batch_lines_.resize(batch_size);
+  batch_rands_.resize(2 * batch_size);
+  batch_frames_.resize(batch_size);
+  batch_ok_.resize(batch_size);
+  batch_datums_.resize(batch_size);
+  // Read a data point, and use it to initialize the top blob.
+  this->phase_ = Caffe::phase();
+  batch_lines_[0] = lines_[lines_id_];
+  batch_rands_[0] = batch_rands_[1] = 0;
+  CHECK(ReadVideoWindow(0, readers_[0].get()));
+  const Datum& datum = batch_datums_[0];
+
+  int crop_width = 0;
+  int crop_height = 0;
+  const int video_crop_size_h =
+      this->layer_param_.transform_param().video_crop_size_h();
+  const int video_crop_size_w =
+      this->layer_param_.transform_param().video_crop_size_w();
+  const int crop_size = this->layer_param_.transform_param().crop_size();
+  if (video_crop_size_h != 0 && video_crop_size_w != 0) {
+    crop_width = video_crop_size_w;
+    crop_height = video_crop_size_h;
+  } else {
+    crop_width = crop_height = crop_size;
+  }
+  if (crop_width > 0 && crop_height > 0) {
+    (*top)[0]->Reshape(batch_size, datum.channels() * crop_frames,
+                       crop_height, crop_width);
+  } else {
+    (*top)[0]->Reshape(batch_size, datum.channels() * crop_frames,
+                       datum.height(), datum.width());
+  }
+  LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
+      << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
+      << (*top)[0]->width();
+  // label
+  (*top)[1]->Reshape(batch_size, 1, 1, 1);
+  // datum size
+  this->datum_frames_ = datum.frames();
+  this->datum_channels_ = datum.channels();
+  this->datum_height_ = datum.height();
+  this->datum_width_ = datum.width();
+  this->datum_size_ = datum.channels() * datum.height() * datum.width();
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::ShuffleVideos() {
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+}
+
+template <typename Dtype>
+unsigned int VideoDataLayer<Dtype>::PrefetchRand() {
+  CHECK(prefetch_rng_);
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  return (*prefetch_rng)();
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::NextBatchLine(const int item_id) {
+  batch_lines_[item_id] = lines_[lines_id_];
+  batch_rands_[2 * item_id] = PrefetchRand();
+  batch_rands_[2 * item_id + 1] = PrefetchRand();
+  // go to the next iter
+  lines_id_++;
+  if (lines_id_ >= lines_.size()) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    lines_id_ = 0;
+    if (this->layer_param_.video_data_param().shuffle()) {
+      ShuffleVideos();
+    }
+  }
+}
+
+// Mirrors the temporal sampling of DataTransformer::Transform: the step is
+// bounded by video_step_max, and both step and offset are random in TRAIN.
+template <typename Dtype>
+void VideoDataLayer<Dtype>::SampleWindow(const int frames,
+      const unsigned int rand_step, const unsigned int rand_offset,
+      int* start_frame, int* step) {
+  const int crop_frames = this->layer_param_.transform_param().video_crop_size_t();
+  const int video_step_max =
+      this->layer_param_.transform_param().video_step_max();
+  int v_step = frames / crop_frames;
+  if (v_step == 0) {
+    // The clip is shorter than the window; the transformer pads it.
+    *start_frame = 0;
+    *step = 1;
+    return;
+  }
+  v_step = std::min(v_step, video_step_max);
+  if (this->phase_ == Caffe::TRAIN) {
+    if (v_step >= 2) {
+      v_step = rand_step % v_step + 1;
+    }
+    *start_frame = rand_offset % (frames - crop_frames * v_step + v_step);
+  } else {
+    *start_frame = (frames - (crop_frames - 1) * v_step - 1) / 2;
+  }
+  *step = v_step;
+}
+
+template <typename Dtype>
+bool VideoDataLayer<Dtype>::ReadVideoWindow(const int item_id,
+      DatumVideoReader* reader) {
+  const VideoDataParameter& video_data_param =
+      this->layer_param_.video_data_param();
+  const string& filename = batch_lines_[item_id].first;
+  const int label = batch_lines_[item_id].second;
+  Datum* datum = &batch_datums_[item_id];
+  // frame_counts_ is only read here; new counts are merged in by the
+  // prefetch thread once the decode threads are done.
+  std::map<string, int>::const_iterator count = frame_counts_.find(filename);
+  int frames;
+  if (count == frame_counts_.end()) {
+    frames = reader->CountFrames(filename);
+    if (frames < 0) {
+      return false;
+    }
+  } else {
+    frames = count->second;
+  }
+  batch_frames_[item_id] = frames;
+  if (frames == 0) {
+    // The container does not report its length, so decode the whole clip and
+    // leave the temporal crop to the transformer.
+    return reader->ReadVideoToDatum(filename, label,
+        video_data_param.new_height(), video_data_param.new_width(),
+        video_data_param.is_color(), datum);
+  }
+  int start_frame, step;
+  SampleWindow(frames, batch_rands_[2 * item_id], batch_rands_[2 * item_id + 1],
+               &start_frame, &step);
+  return reader->ReadVideoWindow(filename, label, start_frame,
+      this->layer_param_.transform_param().video_crop_size_t(), step,
+      video_data_param.new_height(), video_data_param.new_width(),
+      video_data_param.is_color(), datum);
+}
+
+template <typename Dtype>
+void VideoDataLayer<Dtype>::DecodeVideos(const int thread_id) {
+  const int batch_size = batch_lines_.size();
+  const int num_threads = readers_.size();
+  for (int item_id = thread_id; item_id < batch_size; item_id += num_threads) {
+    batch_ok_[item_id] = ReadVideoWindow(item_id, readers_[thread_id].get());
+  }
+}
+
+// This function is called on the prefetch thread to load a batch.
+template <typename Dtype>
+void VideoDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
+  const int batch_size = this->layer_param_.video_data_param().batch_size();
+
+  // Assign the lines and draw the random numbers serially, so that the batch
+  // does not depend on the thread scheduling.
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    NextBatchLine(item_id);
+  }
+  // Decode the batch on the decode threads; this thread takes the first share.
+  // The videos are read as they are decoded, so both count as parsing.
+  CPUTimer timer;
+  timer.Start();
+  decode_pool_->Run(
+      boost::bind(&VideoDataLayer<Dtype>::DecodeVideos, this, _1));
+  batch->timings_.parse_ms = timer.MilliSeconds();
+
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    // replace the videos that could not be read by the next ones in the list
+    timer.Start();
+    // Having tried every line of the list, none of the videos can be read.
+    for (int retries = 0; !batch_ok_[item_id]; ++retries) {
+      CHECK_LT(retries, lines_.size()) << "Could not read any of the videos in "
+          << this->layer_param_.video_data_param().source();
+      NextBatchLine(item_id);
+      batch_ok_[item_id] = ReadVideoWindow(item_id, readers_[0].get());
+    }
+    frame_counts_[batch_lines_[item_id].first] = batch_frames_[item_id];
+    batch->timings_.parse_ms += timer.MilliSeconds();
+
+    // Apply transformations (mirror, crop...) to the data
+    timer.Start();
+    const Datum& datum = batch_datums_[item_id];
+    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
+    top_label[item_id] = datum.label();
+    batch->timings_.transform_ms += timer.MilliSeconds();
+  }
+}
+
+INSTANTIATE_CLASS(VideoDataLayer);
+
+}  // namespace caffe
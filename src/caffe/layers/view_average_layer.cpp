@@ -0,0 +1,74 @@
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ViewAverageLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  num_views_ = this->layer_param_.view_average_param().num_views();
+  CHECK_GT(num_views_, 0) << "num_views must be positive";
+}
+
+template <typename Dtype>
+void ViewAverageLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  for (int i = 0; i < bottom.size(); ++i) {
+    CHECK_EQ(bottom[i]->num() % num_views_, 0)
+        << "The num of bottom " << i << " must be a multiple of num_views";
+    (*top)[i]->Reshape(bottom[i]->num() / num_views_, bottom[i]->channels(),
+        bottom[i]->height(), bottom[i]->width());
+  }
+}
+
+template <typename Dtype>
+void ViewAverageLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const Dtype weight = Dtype(1) / num_views_;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    const int dim = bottom[i]->count() / bottom[i]->num();
+    for (int n = 0; n < (*top)[i]->num(); ++n) {
+      caffe_cpu_scale(dim, weight, bottom_data, top_data);
+      bottom_data += dim;
+      for (int v = 1; v < num_views_; ++v) {
+        caffe_axpy(dim, weight, bottom_data, top_data);
+        bottom_data += dim;
+      }
+      top_data += dim;
+    }
+  }
+}
+
+template <typename Dtype>
+void ViewAverageLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype weight = Dtype(1) / num_views_;
+  for (int i = 0; i < top.size(); ++i) {
+    if (!propagate_down[i]) {
+      continue;
+    }
+    const Dtype* top_diff = top[i]->cpu_diff();
+    Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
+    const int dim = top[i]->count() / top[i]->num();
+    for (int n = 0; n < top[i]->num(); ++n) {
+      for (int v = 0; v < num_views_; ++v) {
+        caffe_cpu_scale(dim, weight, top_diff, bottom_diff);
+        bottom_diff += dim;
+      }
+      top_diff += dim;
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(ViewAverageLayer);
+#endif
+
+INSTANTIATE_CLASS(ViewAverageLayer);
+
+}  // namespace caffe
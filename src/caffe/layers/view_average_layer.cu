@@ -0,0 +1,52 @@
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ViewAverageLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const Dtype weight = Dtype(1) / num_views_;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    Dtype* top_data = (*top)[i]->mutable_gpu_data();
+    const int dim = bottom[i]->count() / bottom[i]->num();
+    for (int n = 0; n < (*top)[i]->num(); ++n) {
+      caffe_gpu_scale(dim, weight, bottom_data, top_data);
+      bottom_data += dim;
+      for (int v = 1; v < num_views_; ++v) {
+        caffe_gpu_axpy(dim, weight, bottom_data, top_data);
+        bottom_data += dim;
+      }
+      top_data += dim;
+    }
+  }
+}
+
+template <typename Dtype>
+void ViewAverageLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype weight = Dtype(1) / num_views_;
+  for (int i = 0; i < top.size(); ++i) {
+    if (!propagate_down[i]) {
+      continue;
+    }
+    const Dtype* top_diff = top[i]->gpu_diff();
+    Dtype* bottom_diff = (*bottom)[i]->mutable_gpu_diff();
+    const int dim = top[i]->count() / top[i]->num();
+    for (int n = 0; n < top[i]->num(); ++n) {
+      for (int v = 0; v < num_views_; ++v) {
+        caffe_gpu_scale(dim, weight, top_diff, bottom_diff);
+        bottom_diff += dim;
+      }
+      top_diff += dim;
+    }
+  }
+}
+
+INSTANTIATE_CLASS(ViewAverageLayer);
+
+}  // namespace caffe
@@ -4,9 +4,11 @@
 #include <string>
 #include <vector>
 
+#include "caffe/data_layers.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
@@ -186,6 +188,21 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   vector<Dtype> losses;
   Dtype smoothed_loss = 0;
 
+  // The data layers keep the timings of their batches for the display.
+  if (param_.display()) {
+    const vector<shared_ptr<Layer<Dtype> > >& layers = net_->layers();
+    for (int i = 0; i < layers.size(); ++i) {
+      BasePrefetchingDataLayer<Dtype>* data_layer =
+          dynamic_cast<BasePrefetchingDataLayer<Dtype>*>(layers[i].get());
+      if (data_layer) {
+        data_layer->set_record_timings(true);
+      }
+    }
+  }
+  // The training time since the last display, snapshots and tests excluded
+  CPUTimer iter_timer;
+  float train_ms = 0;
+
   // For a network that is trained by the solver, no bottom or top vecs
   // should be given, and we will just provide dummy vecs.
   vector<Blob<Dtype>*> bottom_vec;
@@ -203,6 +220,7 @@ void Solver<Dtype>::Solve(const char* resume_file) {
 
     const bool display = param_.display() && iter_ % param_.display() == 0;
     net_->set_debug_info(display && param_.debug_info());
+    iter_timer.Start();
     Dtype loss = 0;
     for (int acum_num = 0; acum_num < param_.update_interval() - 1; ++acum_num) {
       loss += net_->ForwardBackward(bottom_vec);
@@ -241,10 +259,15 @@ void Solver<Dtype>::Solve(const char* resume_file) {
               << result_vec[k] << loss_msg_stream.str();
         }
       }
+      train_ms += iter_timer.MilliSeconds();
+      DisplayInputTimings(train_ms);
+      train_ms = 0;
+      iter_timer.Start();
     }
 
     ComputeUpdateValue();
     net_->Update();
+    train_ms += iter_timer.MilliSeconds();
   }
   // Always save a snapshot after optimization, unless overridden by setting
   // snapshot_after_train := false.
@@ -334,6 +357,53 @@ void Solver<Dtype>::Test(const int test_net_id) {
 }
 
 
+template <typename Dtype>
+void Solver<Dtype>::DisplayInputTimings(const float elapsed_ms) {
+  const int num_stages = 5;
+  const char* stage_names[num_stages] =
+      { "wait", "fetch", "parse", "transform", "load" };
+  float BatchTimings::* stages[num_stages] = { &BatchTimings::wait_ms,
+      &BatchTimings::fetch_ms, &BatchTimings::parse_ms,
+      &BatchTimings::transform_ms, &BatchTimings::load_ms };
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net_->layers();
+  for (int i = 0; i < layers.size(); ++i) {
+    BasePrefetchingDataLayer<Dtype>* data_layer =
+        dynamic_cast<BasePrefetchingDataLayer<Dtype>*>(layers[i].get());
+    if (!data_layer) {
+      continue;
+    }
+    vector<BatchTimings> timings;
+    data_layer->TakeTimings(&timings);
+    if (timings.empty()) {
+      continue;
+    }
+    // The share of the training time spent waiting for the batches, which
+    // more reader or transform threads would reduce.
+    float wait_ms = 0;
+    for (int j = 0; j < timings.size(); ++j) {
+      wait_ms += timings[j].wait_ms;
+    }
+    const string& layer_name = net_->layer_names()[i];
+    LOG(INFO) << "    Input " << layer_name << ": " << timings.size()
+              << " batches, input-bound "
+              << (elapsed_ms > 0 ? 100 * wait_ms / elapsed_ms : 0) << "%";
+    vector<float> values(timings.size());
+    for (int s = 0; s < num_stages; ++s) {
+      for (int j = 0; j < timings.size(); ++j) {
+        values[j] = timings[j].*stages[s];
+      }
+      std::sort(values.begin(), values.end());
+      if (values.back() == 0) {
+        continue;  // a stage the layer does not time
+      }
+      const int n = values.size() - 1;
+      LOG(INFO) << "    Input " << layer_name << " " << stage_names[s]
+                << " p50/p90/max = " << values[n / 2] << " / "
+                << values[n * 9 / 10] << " / " << values[n] << " ms";
+    }
+  }
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
   NetParameter net_param;
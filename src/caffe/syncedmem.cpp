@@ -1,3 +1,6 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <cstring>
 
 #include "caffe/common.hpp"
@@ -6,9 +9,54 @@
 
 namespace caffe {
 
+void CaffeMallocHost(void** ptr, size_t size, HostMemory* memory) {
+#ifndef CPU_ONLY
+  if (*memory == HOST_PINNED && Caffe::mode() == Caffe::GPU &&
+      cudaMallocHost(ptr, size) == cudaSuccess) {
+    return;
+  }
+#endif
+  if (*memory == HOST_LOCKED) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    if (posix_memalign(ptr, page_size, size) == 0) {
+#ifdef MADV_HUGEPAGE
+      madvise(*ptr, size, MADV_HUGEPAGE);
+#endif
+      if (mlock(*ptr, size) == 0) {
+        return;
+      }
+      LOG(WARNING) << "Could not lock " << size << " bytes of host memory, "
+                   << "see ulimit -l";
+      *memory = HOST_PAGEABLE;
+      return;
+    }
+  }
+  *memory = HOST_PAGEABLE;
+  *ptr = malloc(size);
+}
+
+void CaffeFreeHost(void* ptr, size_t size, HostMemory memory) {
+  switch (memory) {
+  case HOST_PINNED:
+#ifndef CPU_ONLY
+    CUDA_CHECK(cudaFreeHost(ptr));
+#else
+    NO_GPU;
+#endif
+    break;
+  case HOST_LOCKED:
+    munlock(ptr, size);
+    free(ptr);
+    break;
+  case HOST_PAGEABLE:
+    free(ptr);
+    break;
+  }
+}
+
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_, host_memory_);
   }
 
 #ifndef CPU_ONLY
@@ -21,7 +69,7 @@ SyncedMemory::~SyncedMemory() {
 inline void SyncedMemory::to_cpu() {
   switch (head_) {
   case UNINITIALIZED:
-    CaffeMallocHost(&cpu_ptr_, size_);
+    CaffeMallocHost(&cpu_ptr_, size_, &host_memory_);
     caffe_memset(size_, 0, cpu_ptr_);
     head_ = HEAD_AT_CPU;
     own_cpu_data_ = true;
@@ -29,7 +77,7 @@ inline void SyncedMemory::to_cpu() {
   case HEAD_AT_GPU:
 #ifndef CPU_ONLY
     if (cpu_ptr_ == NULL) {
-      CaffeMallocHost(&cpu_ptr_, size_);
+      CaffeMallocHost(&cpu_ptr_, size_, &host_memory_);
       own_cpu_data_ = true;
     }
     caffe_gpu_memcpy(size_, gpu_ptr_, cpu_ptr_);
@@ -76,7 +124,7 @@ const void* SyncedMemory::cpu_data() {
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
   if (own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_);
+    CaffeFreeHost(cpu_ptr_, size_, host_memory_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
@@ -98,6 +146,23 @@ void* SyncedMemory::mutable_cpu_data() {
   return cpu_ptr_;
 }
 
+void SyncedMemory::set_host_memory(HostMemory memory) {
+  CHECK(cpu_ptr_ == NULL) << "The host memory is already allocated";
+  host_memory_ = memory;
+}
+
+#ifndef CPU_ONLY
+void SyncedMemory::async_gpu_push(const cudaStream_t& stream) {
+  CHECK(head_ == HEAD_AT_CPU);
+  if (gpu_ptr_ == NULL) {
+    CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+  }
+  CUDA_CHECK(cudaMemcpyAsync(gpu_ptr_, cpu_ptr_, size_,
+                             cudaMemcpyHostToDevice, stream));
+  head_ = SYNCED;
+}
+#endif
+
 void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
   to_gpu();
@@ -1,3 +1,4 @@
+#include <set>
 #include <string>
 #include <vector>
 
@@ -65,7 +66,9 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
   }
 
   // Fill the LMDB with data: unique_pixels has same meaning as in FillLevelDB.
-  void FillLMDB(const bool unique_pixels) {
+  // With frames, the datums are videos whose pixels are 10 times the label
+  // plus the frame index.
+  void FillLMDB(const bool unique_pixels, const int frames = 0) {
     backend_ = DataParameter_DB_LMDB;
     LOG(INFO) << "Using temporary lmdb " << *filename_;
     CHECK_EQ(mkdir(filename_->c_str(), 0744), 0) << "mkdir " << filename_
@@ -90,7 +93,13 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
       datum.set_height(3);
       datum.set_width(4);
       std::string* data = datum.mutable_data();
-      for (int j = 0; j < 24; ++j) {
+      if (frames > 0) {
+        datum.set_frames(frames);
+        for (int j = 0; j < frames * 24; ++j) {
+          data->push_back(static_cast<uint8_t>(10 * i + j / 24));
+        }
+      }
+      for (int j = 0; j < 24 && frames == 0; ++j) {
         int datum = unique_pixels ? j : i;
         data->push_back(static_cast<uint8_t>(datum));
       }
@@ -149,7 +158,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCrop() {
+  void TestReadCrop(const int transform_threads = 1) {
     const Dtype scale = 3;
     LayerParameter param;
     Caffe::set_random_seed(1701);
@@ -158,6 +167,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_transform_threads(transform_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -202,12 +212,13 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(const int transform_threads = 1) {
     LayerParameter param;
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_transform_threads(transform_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -312,6 +323,190 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Reads num_shards shards of the db with shuffled keys, and checks that
+  // every shard sees each of its records once per epoch, each with the data
+  // of its label, and that the shards do not overlap.
+  void TestReadShuffleShards(const int num_shards) {
+    set<int> labels_seen;
+    for (int shard_id = 0; shard_id < num_shards; ++shard_id) {
+      const int shard_size = (5 - shard_id + num_shards - 1) / num_shards;
+      LayerParameter param;
+      DataParameter* data_param = param.mutable_data_param();
+      data_param->set_batch_size(shard_size);
+      data_param->set_source(filename_->c_str());
+      data_param->set_backend(backend_);
+      data_param->set_shuffle(true);
+      data_param->set_shard_id(shard_id);
+      data_param->set_num_shards(num_shards);
+
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+      EXPECT_EQ(blob_top_data_->num(), shard_size);
+      set<int> shard_labels;
+      for (int iter = 0; iter < 3; ++iter) {
+        layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+        set<int> epoch_labels;
+        for (int i = 0; i < shard_size; ++i) {
+          const int label = blob_top_label_->cpu_data()[i];
+          EXPECT_EQ(label % num_shards, shard_id);
+          epoch_labels.insert(label);
+          for (int j = 0; j < 24; ++j) {
+            EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j]);
+          }
+        }
+        EXPECT_EQ(epoch_labels.size(), shard_size);
+        shard_labels.insert(epoch_labels.begin(), epoch_labels.end());
+      }
+      EXPECT_EQ(shard_labels.size(), shard_size);
+      labels_seen.insert(shard_labels.begin(), shard_labels.end());
+    }
+    EXPECT_EQ(labels_seen.size(), 5);
+  }
+
+  // Reads several epochs through a cache of cache_bytes, which holds
+  // cache_bytes / 25 of the 24-byte datums and their 1-byte keys.
+  void TestReadCache(const DataParameter_CachePolicy policy,
+                     const int cache_bytes) {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(3);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_cache_bytes(cache_bytes);
+    data_param->set_cache_policy(policy);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    int label = 0;
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(label, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+        label = (label + 1) % 5;
+      }
+    }
+  }
+
+  // Reads 3 clips of 2 frames from each of the 8-frame videos in TEST, which
+  // must start at the first, middle and last possible frames.
+  void TestReadClipsPerSample() {
+    Caffe::set_phase(Caffe::TEST);
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(6);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_is_video(true);
+    transform_param->set_video_crop_size_t(2);
+    transform_param->set_clips_per_sample(3);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 6);
+    EXPECT_EQ(blob_top_data_->channels(), 2 * 2);
+    int label = 0;
+    for (int iter = 0; iter < 5; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 6; i += 3) {
+        for (int clip_id = 0; clip_id < 3; ++clip_id) {
+          EXPECT_EQ(label, blob_top_label_->cpu_data()[i + clip_id]);
+          for (int f = 0; f < 2; ++f) {
+            for (int j = 0; j < 24; ++j) {
+              EXPECT_EQ(10 * label + 3 * clip_id + f,
+                  blob_top_data_->cpu_data()[((i + clip_id) * 2 + f) * 24 + j]);
+            }
+          }
+        }
+        label = (label + 1) % 5;
+      }
+    }
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+
+  // Reads the 3-frame videos as 8-frame clips, which pads them with 2 empty
+  // frames in front and 3 behind.
+  void TestReadPaddedClip() {
+    Caffe::set_phase(Caffe::TEST);
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_is_video(true);
+    transform_param->set_video_crop_size_t(8);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 5);
+    EXPECT_EQ(blob_top_data_->channels(), 8 * 2);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, blob_top_label_->cpu_data()[i]);
+        for (int f = 0; f < 8; ++f) {
+          const int expected = (f >= 2 && f <= 4) ? 10 * i + f - 2 : 0;
+          for (int j = 0; j < 24; ++j) {
+            EXPECT_EQ(expected,
+                blob_top_data_->cpu_data()[(i * 8 + f) * 24 + j])
+                << "debug: item " << i << " frame " << f;
+          }
+        }
+      }
+    }
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+
+  // Reads the 5 crops of the 2 x 3 x 4 images and their mirrors in TEST, the
+  // layer being set up in setup_phase, as the test nets of a solver are.
+  void TestReadTestViews(const Caffe::Phase setup_phase = Caffe::TEST) {
+    Caffe::set_phase(setup_phase);
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(10);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_crop_size(2);
+    transform_param->set_test_crops(5);
+    transform_param->set_test_mirror(true);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 10);
+    Caffe::set_phase(Caffe::TEST);
+    // center, top left, top right, bottom left, bottom right
+    const int h_offs[] = {0, 0, 0, 1, 1};
+    const int w_offs[] = {1, 0, 2, 0, 2};
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int v = 0; v < 10; ++v) {
+        EXPECT_EQ(iter, blob_top_label_->cpu_data()[v]);
+        const int crop_id = v / 2;
+        const bool mirrored = v % 2;
+        for (int c = 0; c < 2; ++c) {
+          for (int h = 0; h < 2; ++h) {
+            for (int w = 0; w < 2; ++w) {
+              const int data_w = (mirrored ? 1 - w : w) + w_offs[crop_id];
+              EXPECT_EQ((c * 3 + h + h_offs[crop_id]) * 4 + data_w,
+                  blob_top_data_->cpu_data()[((v * 2 + c) * 2 + h) * 2 + w])
+                  << "debug: view " << v << " c " << c << " h " << h;
+            }
+          }
+        }
+      }
+    }
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+
   virtual ~DataLayerTest() { delete blob_top_data_; delete blob_top_label_; }
 
   DataParameter_DB backend_;
@@ -401,4 +596,101 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
   this->TestReadCrop();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShuffleLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadShuffleShards(1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleShardsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadShuffleShards(2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTestTransformThreadsLMDB) {
+  Caffe::set_phase(Caffe::TEST);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCrop(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededTransformThreadsLMDB) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCropTrainSequenceSeeded(3);
+}
+
+TYPED_TEST(DataLayerTest, TestRecordTimingsLMDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  const bool unique_pixels = false;
+  this->FillLMDB(unique_pixels);
+  LayerParameter param;
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(this->backend_);
+  DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.set_record_timings(true);
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  }
+  // Only the batches passed on while recording are kept, and only once.
+  vector<BatchTimings> timings;
+  layer.TakeTimings(&timings);
+  EXPECT_EQ(timings.size(), 3);
+  for (int i = 0; i < timings.size(); ++i) {
+    EXPECT_GE(timings[i].wait_ms, 0);
+    EXPECT_GE(timings[i].load_ms, timings[i].transform_ms);
+  }
+  layer.TakeTimings(&timings);
+  EXPECT_EQ(timings.size(), 3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheFillLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadCache(DataParameter_CachePolicy_FILL, 3 * 25);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheFillLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCache(DataParameter_CachePolicy_FILL, 3 * 25);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheLRULMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCache(DataParameter_CachePolicy_LRU, 3 * 25);
+  this->TestReadCache(DataParameter_CachePolicy_LRU, 1 << 20);
+}
+
+TYPED_TEST(DataLayerTest, TestReadClipsPerSampleLMDB) {
+  const bool unique_pixels = false;
+  this->FillLMDB(unique_pixels, 8);
+  this->TestReadClipsPerSample();
+}
+
+TYPED_TEST(DataLayerTest, TestReadPaddedClipLMDB) {
+  const bool unique_pixels = false;
+  this->FillLMDB(unique_pixels, 3);
+  this->TestReadPaddedClip();
+}
+
+TYPED_TEST(DataLayerTest, TestReadTestViewsLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLMDB(unique_pixels);
+  this->TestReadTestViews();
+}
+
+TYPED_TEST(DataLayerTest, TestReadTestViewsSetUpInTrainLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLMDB(unique_pixels);
+  this->TestReadTestViews(Caffe::TRAIN);
+}
+
 }  // namespace caffe
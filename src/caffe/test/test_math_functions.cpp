@@ -144,6 +144,28 @@ TYPED_TEST(MathFunctionsTest, TestCopyCPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestUint8SubScaleCPU) {
+  // 37 covers the vectorized blocks as well as the remainder.
+  const int n = 37;
+  uint8_t x[n];
+  for (int i = 0; i < n; ++i) {
+    x[i] = static_cast<uint8_t>(caffe_rng_rand() % 256);
+  }
+  const TypeParam* mean = this->blob_bottom_->cpu_data();
+  const TypeParam scale = 0.5;
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  for (int mean_step = 0; mean_step <= 1; ++mean_step) {
+    for (int reverse = 0; reverse <= 1; ++reverse) {
+      caffe_cpu_uint8_sub_scale<TypeParam>(n, x, mean, mean_step, scale,
+                                           reverse, y);
+      for (int i = 0; i < n; ++i) {
+        EXPECT_EQ((static_cast<TypeParam>(x[i]) - mean[i * mean_step]) * scale,
+                  y[reverse ? n - 1 - i : i]);
+      }
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 // TODO: Fix caffe_gpu_hamming_distance and re-enable this test.
@@ -211,6 +211,67 @@ TYPED_TEST(RecursiveOnceTest, TestGradient) {
 
 
 
+TYPED_TEST(RecursiveOnceTest, TestForwardBackwardThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  RecursiveOnceParameter* recursive_once_param = 
+  	layer_param.mutable_recursive_once_param();
+
+  recursive_once_param->set_group(8);
+  recursive_once_param->set_assemble_size(2);
+  recursive_once_param->set_stride(4);
+  recursive_once_param->set_num_uv(3);
+  recursive_once_param->add_relative_position(0);
+  recursive_once_param->add_relative_position(2);
+  recursive_once_param->add_relative_position(3);
+  recursive_once_param->mutable_weight_filler()->set_type("gaussian");
+  recursive_once_param->mutable_bias_filler()->set_type("gaussian");
+
+  // 3 samples split over 2 threads must give the results of 1 thread
+  this->blob_bottom_->Reshape(3, 96, 3, 3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  RecursiveOnceLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  filler.Fill(this->blob_top_);
+  Blob<Dtype> top_diff;
+  top_diff.CopyFrom(*this->blob_top_, false, true);
+  vector<bool> propagate_down(1, true);
+  Blob<Dtype> ref_top, ref_bottom_diff, ref_weight_diff, ref_bias_diff;
+  for (int num_threads = 1; num_threads <= 2; ++num_threads) {
+    Caffe::set_cpu_threads(num_threads);
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   &(this->blob_bottom_vec_));
+    if (num_threads == 1) {
+      ref_top.CopyFrom(*this->blob_top_, false, true);
+      ref_bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+      ref_weight_diff.CopyFrom(*layer.blobs()[0], true, true);
+      ref_bias_diff.CopyFrom(*layer.blobs()[1], true, true);
+      continue;
+    }
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i], ref_top.cpu_data()[i], 1e-4);
+    }
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+                  ref_bottom_diff.cpu_diff()[i], 1e-4);
+    }
+    for (int i = 0; i < layer.blobs()[0]->count(); ++i) {
+      EXPECT_NEAR(layer.blobs()[0]->cpu_diff()[i],
+                  ref_weight_diff.cpu_diff()[i], 1e-4);
+    }
+    for (int i = 0; i < layer.blobs()[1]->count(); ++i) {
+      EXPECT_NEAR(layer.blobs()[1]->cpu_diff()[i],
+                  ref_bias_diff.cpu_diff()[i], 1e-4);
+    }
+  }
+  Caffe::set_cpu_threads(1);
+}
+
 }
 
 
@@ -121,6 +121,47 @@ TEST_F(SyncedMemoryTest, TestGPUWrite) {
   EXPECT_EQ(mem.head(), SyncedMemory::SYNCED);
 }
 
+TEST_F(SyncedMemoryTest, TestAsyncGPUPush) {
+  SyncedMemory mem(10);
+  mem.set_host_memory(HOST_PINNED);
+  void* cpu_data = mem.mutable_cpu_data();
+  caffe_memset(mem.size(), 3, cpu_data);
+  cudaStream_t stream;
+  CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+  mem.async_gpu_push(stream);
+  CUDA_CHECK(cudaStreamSynchronize(stream));
+  CUDA_CHECK(cudaStreamDestroy(stream));
+  EXPECT_EQ(mem.head(), SyncedMemory::SYNCED);
+  char recovered_value[10];
+  caffe_gpu_memcpy(10, mem.gpu_data(), recovered_value);
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ(recovered_value[i], 3);
+  }
+}
+
 #endif
 
+TEST_F(SyncedMemoryTest, TestLockedCPUWrite) {
+  // 1MB, so that the memory may be backed by huge pages
+  SyncedMemory mem(1 << 20);
+  mem.set_host_memory(HOST_LOCKED);
+  void* cpu_data = mem.mutable_cpu_data();
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_CPU);
+  // Locking is subject to ulimit -l, and falls back to pageable memory.
+  EXPECT_NE(mem.host_memory(), HOST_PINNED);
+  caffe_memset(mem.size(), 1, cpu_data);
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ((static_cast<char*>(cpu_data))[i], 1);
+  }
+}
+
+TEST_F(SyncedMemoryTest, TestPinnedFallback) {
+  // Pinned memory is only allocated in GPU mode.
+  Caffe::set_mode(Caffe::CPU);
+  SyncedMemory mem(10);
+  mem.set_host_memory(HOST_PINNED);
+  EXPECT_TRUE(mem.mutable_cpu_data());
+  EXPECT_EQ(mem.host_memory(), HOST_PAGEABLE);
+}
+
 }  // namespace caffe
@@ -215,7 +215,232 @@ TYPED_TEST(TemporalConvolutionTest, TestGradient) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(TemporalConvolutionTest, TestForwardPerWindow) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalConvolutionParameter* temporal_convolution_param = 
+    layer_param.mutable_temporal_convolution_param();
+
+  temporal_convolution_param->set_stride(1);
+  temporal_convolution_param->set_group(8); 
+  temporal_convolution_param->set_pad(1); 
+  temporal_convolution_param->set_num_output(10);
+  temporal_convolution_param->set_kernel_size(3);
+  // one GEMM per window, as on large maps
+  temporal_convolution_param->set_batched_gemm_max_size(0);
+
+  temporal_convolution_param->mutable_weight_filler()->set_type("gaussian");
+  temporal_convolution_param->mutable_bias_filler()->set_type("gaussian");
+
+  shared_ptr<Layer<Dtype> > layer (
+    new TemporalConvolutionLayer<Dtype>(layer_param));
+
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+
+  caffe_temporal_conv(this->blob_bottom_, temporal_convolution_param, layer->blobs(),
+                  this->MakeReferenceTop(this->blob_top_));
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(TemporalConvolutionTest, TestForwardAllPadded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalConvolutionParameter* temporal_convolution_param = 
+    layer_param.mutable_temporal_convolution_param();
+
+  // the first and last windows lie entirely in the padding
+  temporal_convolution_param->set_stride(2);
+  temporal_convolution_param->set_group(8); 
+  temporal_convolution_param->set_pad(3); 
+  temporal_convolution_param->set_num_output(4);
+  temporal_convolution_param->set_kernel_size(3);
+  temporal_convolution_param->set_batched_gemm_max_size(0);
+
+  temporal_convolution_param->mutable_weight_filler()->set_type("gaussian");
+  temporal_convolution_param->mutable_bias_filler()->set_type("gaussian");
+
+  for (int bias_term = 0; bias_term < 2; ++bias_term) {
+    temporal_convolution_param->set_bias_term(bias_term);
+    shared_ptr<Layer<Dtype> > layer (
+      new TemporalConvolutionLayer<Dtype>(layer_param));
+
+    layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+
+    caffe_temporal_conv(this->blob_bottom_, temporal_convolution_param, layer->blobs(),
+                    this->MakeReferenceTop(this->blob_top_));
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+
+    layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const Dtype* top_data = this->blob_top_->cpu_data();
+
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
 
+TYPED_TEST(TemporalConvolutionTest, TestGradientPerWindow) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalConvolutionParameter* temporal_convolution_param = 
+  	layer_param.mutable_temporal_convolution_param();
+
+  temporal_convolution_param->set_stride(2);
+  temporal_convolution_param->set_group(8); 
+  temporal_convolution_param->set_pad(2); 
+  temporal_convolution_param->set_num_output(5);
+  temporal_convolution_param->set_kernel_size(3);
+  temporal_convolution_param->set_batched_gemm_max_size(0);
+
+  temporal_convolution_param->mutable_weight_filler()->set_type("gaussian");
+  temporal_convolution_param->mutable_bias_filler()->set_type("gaussian");
+
+  TemporalConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(TemporalConvolutionTest, TestGradientNoBias) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalConvolutionParameter* temporal_convolution_param = 
+  	layer_param.mutable_temporal_convolution_param();
+
+  temporal_convolution_param->set_stride(2);
+  temporal_convolution_param->set_group(8); 
+  temporal_convolution_param->set_pad(2); 
+  temporal_convolution_param->set_num_output(5);
+  temporal_convolution_param->set_kernel_size(3);
+  temporal_convolution_param->set_bias_term(false);
+
+  temporal_convolution_param->mutable_weight_filler()->set_type("gaussian");
+
+  TemporalConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+
+TYPED_TEST(TemporalConvolutionTest, TestForwardThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalConvolutionParameter* temporal_convolution_param = 
+    layer_param.mutable_temporal_convolution_param();
+
+  temporal_convolution_param->set_stride(2);
+  temporal_convolution_param->set_group(8); 
+  temporal_convolution_param->set_pad(2); 
+  temporal_convolution_param->set_num_output(10);
+  temporal_convolution_param->set_kernel_size(3);
+
+  temporal_convolution_param->mutable_weight_filler()->set_type("gaussian");
+  temporal_convolution_param->mutable_bias_filler()->set_type("gaussian");
+
+  // 2 threads split the 3 samples unevenly
+  Caffe::set_cpu_threads(2);
+  for (int batched = 0; batched < 2; ++batched) {
+    temporal_convolution_param->set_batched_gemm_max_size(batched ? 256 : 0);
+    shared_ptr<Layer<Dtype> > layer (
+      new TemporalConvolutionLayer<Dtype>(layer_param));
+
+    layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+
+    caffe_temporal_conv(this->blob_bottom_, temporal_convolution_param, layer->blobs(),
+                    this->MakeReferenceTop(this->blob_top_));
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+
+    layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const Dtype* top_data = this->blob_top_->cpu_data();
+
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(TemporalConvolutionTest, TestGradientThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalConvolutionParameter* temporal_convolution_param = 
+  	layer_param.mutable_temporal_convolution_param();
+
+  temporal_convolution_param->set_stride(2);
+  temporal_convolution_param->set_group(8); 
+  temporal_convolution_param->set_pad(2); 
+  temporal_convolution_param->set_num_output(5);
+  temporal_convolution_param->set_kernel_size(3);
+
+  temporal_convolution_param->mutable_weight_filler()->set_type("gaussian");
+  temporal_convolution_param->mutable_bias_filler()->set_type("gaussian");
+
+  Caffe::set_cpu_threads(3);
+  TemporalConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+  Caffe::set_cpu_threads(1);
+}
+
+TYPED_TEST(TemporalConvolutionTest, TestBackwardFrozenWeightThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalConvolutionParameter* temporal_convolution_param = 
+    layer_param.mutable_temporal_convolution_param();
+
+  temporal_convolution_param->set_stride(2);
+  temporal_convolution_param->set_group(8); 
+  temporal_convolution_param->set_pad(2); 
+  temporal_convolution_param->set_num_output(5);
+  temporal_convolution_param->set_kernel_size(3);
+
+  temporal_convolution_param->mutable_weight_filler()->set_type("gaussian");
+  temporal_convolution_param->mutable_bias_filler()->set_type("gaussian");
+
+  // The bottom diff of 2 threads with a frozen weight must match the one of
+  // a single thread, and the weight diff must be left alone.
+  vector<bool> propagate_down(1, true);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int batched = 0; batched < 2; ++batched) {
+    temporal_convolution_param->set_batched_gemm_max_size(batched ? 256 : 0);
+    Caffe::set_cpu_threads(1);
+    TemporalConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   &(this->blob_bottom_vec_));
+    Blob<Dtype> ref_bottom_diff;
+    ref_bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+
+    Caffe::set_cpu_threads(2);
+    layer.set_param_propagate_down(0, false);
+    Blob<Dtype>* weight = layer.blobs()[0].get();
+    caffe_set(weight->count(), Dtype(7), weight->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   &(this->blob_bottom_vec_));
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+                  ref_bottom_diff.cpu_diff()[i], 1e-4);
+    }
+    for (int i = 0; i < weight->count(); ++i) {
+      EXPECT_EQ(weight->cpu_diff()[i], Dtype(7));
+    }
+  }
+  Caffe::set_cpu_threads(1);
+}
 
 }
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <vector>
 
@@ -15,6 +17,76 @@
 
 namespace caffe {
 
+// Max pools every window frame by frame, the ties going to the earliest frame,
+// and routes top_diff back to the frames taken.
+template <typename Dtype>
+void caffe_temporal_max_pool(const Blob<Dtype>* in,
+    const TemporalPoolingParameter& param, const Blob<Dtype>* top_diff,
+    Blob<Dtype>* out, Blob<Dtype>* in_diff) {
+  const int group = param.group();
+  const int kernel = param.kernel_size();
+  const int stride = param.stride();
+  const int pad = param.pad();
+  const int plane = in->count() / in->num() / group;
+  const int pooled = out->count() / out->num() / plane;
+  in_diff->ReshapeLike(*in);
+  caffe_set(in_diff->count(), Dtype(0), in_diff->mutable_cpu_diff());
+  for (int n = 0; n < in->num(); ++n) {
+    const Dtype* x = in->cpu_data() + in->offset(n);
+    Dtype* x_diff = in_diff->mutable_cpu_diff() + in->offset(n);
+    for (int g = 0; g < pooled; ++g) {
+      const int start = std::max(g * stride - pad, 0);
+      const int end = std::min(g * stride - pad + kernel, group);
+      for (int i = 0; i < plane; ++i) {
+        int best = start;
+        for (int t = start + 1; t < end; ++t) {
+          if (x[t * plane + i] > x[best * plane + i]) {
+            best = t;
+          }
+        }
+        const int top_index = out->offset(n) + g * plane + i;
+        out->mutable_cpu_data()[top_index] = x[best * plane + i];
+        x_diff[best * plane + i] += top_diff->cpu_diff()[top_index];
+      }
+    }
+  }
+}
+
+// Averages every window frame by frame, counting the padded frames, and
+// spreads top_diff back over the frames of each window.
+template <typename Dtype>
+void caffe_temporal_ave_pool(const Blob<Dtype>* in,
+    const TemporalPoolingParameter& param, const Blob<Dtype>* top_diff,
+    Blob<Dtype>* out, Blob<Dtype>* in_diff) {
+  const int group = param.group();
+  const int kernel = param.kernel_size();
+  const int stride = param.stride();
+  const int pad = param.pad();
+  const int plane = in->count() / in->num() / group;
+  const int pooled = out->count() / out->num() / plane;
+  in_diff->ReshapeLike(*in);
+  caffe_set(in_diff->count(), Dtype(0), in_diff->mutable_cpu_diff());
+  for (int n = 0; n < in->num(); ++n) {
+    const Dtype* x = in->cpu_data() + in->offset(n);
+    Dtype* x_diff = in_diff->mutable_cpu_diff() + in->offset(n);
+    for (int g = 0; g < pooled; ++g) {
+      const int pool_size =
+          std::min(g * stride - pad + kernel, group + pad) - (g * stride - pad);
+      const int start = std::max(g * stride - pad, 0);
+      const int end = std::min(g * stride - pad + kernel, group);
+      for (int i = 0; i < plane; ++i) {
+        const int top_index = out->offset(n) + g * plane + i;
+        Dtype sum = 0;
+        for (int t = start; t < end; ++t) {
+          sum += x[t * plane + i];
+          x_diff[t * plane + i] += top_diff->cpu_diff()[top_index] / pool_size;
+        }
+        out->mutable_cpu_data()[top_index] = sum / pool_size;
+      }
+    }
+  }
+}
+
 template <typename TypeParam>
 class TemporalPoolingLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -429,6 +501,24 @@ TYPED_TEST(TemporalPoolingLayerTest, TestGradientMax) {
   }
 }
 
+TYPED_TEST(TemporalPoolingLayerTest, TestGradientMaxThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalPoolingParameter* pooling_param = layer_param.mutable_temporal_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_group(5);
+  pooling_param->set_pad(2);
+  pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_MAX);
+  // more threads than samples
+  Caffe::set_cpu_threads(3);
+  TemporalPoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+  Caffe::set_cpu_threads(1);
+}
+
 TYPED_TEST(TemporalPoolingLayerTest, TestForwardMaxPadded) {
   this->TestForwardSquarePad();
   //this->TestForwardRectHigh();
@@ -452,6 +542,54 @@ TYPED_TEST(TemporalPoolingLayerTest, TestGradientMaxPadded) {
   }
 }
 
+TYPED_TEST(TemporalPoolingLayerTest, TestForwardBackwardMaxOverlapped) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 16 frames of 2 x 2 x 3, rounded so that the windows hold ties
+  this->blob_bottom_->Reshape(2, 48, 2, 3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Dtype* bottom_data = this->blob_bottom_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    bottom_data[i] = floor(bottom_data[i] * 2);
+  }
+  vector<bool> propagate_down(1, true);
+  for (int kernel = 3; kernel <= 7; kernel += 2) {
+    for (int stride = 1; stride < kernel; stride += 2) {
+      for (int pad = 0; pad < kernel; pad += kernel - 1) {
+        LayerParameter layer_param;
+        TemporalPoolingParameter* pooling_param =
+            layer_param.mutable_temporal_pooling_param();
+        pooling_param->set_kernel_size(kernel);
+        pooling_param->set_stride(stride);
+        pooling_param->set_group(16);
+        pooling_param->set_pad(pad);
+        pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_MAX);
+        TemporalPoolingLayer<Dtype> layer(layer_param);
+        layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+        layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+        filler.Fill(this->blob_top_);
+        caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+                   this->blob_top_->mutable_cpu_diff());
+        layer.Backward(this->blob_top_vec_, propagate_down,
+                       &(this->blob_bottom_vec_));
+        Blob<Dtype> ref_top, ref_bottom;
+        ref_top.ReshapeLike(*this->blob_top_);
+        caffe_temporal_max_pool(this->blob_bottom_, *pooling_param,
+                                this->blob_top_, &ref_top, &ref_bottom);
+        layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+        for (int i = 0; i < this->blob_top_->count(); ++i) {
+          EXPECT_EQ(this->blob_top_->cpu_data()[i], ref_top.cpu_data()[i]);
+        }
+        for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+          EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+                      ref_bottom.cpu_diff()[i], 1e-5);
+        }
+      }
+    }
+  }
+}
+
 //TYPED_TEST(TemporalPoolingLayerTest, TestGradientMaxTopMask) {
 //  typedef typename TypeParam::Dtype Dtype;
 //  for (int kernel_h = 3; kernel_h <= 4; kernel_h++) {
@@ -472,89 +610,159 @@ TYPED_TEST(TemporalPoolingLayerTest, TestGradientMaxPadded) {
 //  }
 //}
 
-//TYPED_TEST(TemporalPoolingLayerTest, TestForwardAve) {
-//  typedef typename TypeParam::Dtype Dtype;
-//  LayerParameter layer_param;
-//  TemporalPoolingParameter* pooling_param = layer_param.mutable_temporal_pooling_param();
-//  pooling_param->set_kernel_size(3);
-//  pooling_param->set_stride(1);
-//  pooling_param->set_pad(1);
-//  pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_AVE);
-//  this->blob_bottom_->Reshape(1, 1, 3, 3);
-//  FillerParameter filler_param;
-//  filler_param.set_value(Dtype(2));
-//  ConstantFiller<Dtype> filler(filler_param);
-//  filler.Fill(this->blob_bottom_);
-//  TemporalPoolingLayer<Dtype> layer(layer_param);
-//  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
-//  EXPECT_EQ(this->blob_top_->num(), 1);
-//  EXPECT_EQ(this->blob_top_->channels(), 1);
-//  EXPECT_EQ(this->blob_top_->height(), 3);
-//  EXPECT_EQ(this->blob_top_->width(), 3);
-//  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
-//  Dtype epsilon = 1e-5;
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[0], 8.0 / 9, epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[1], 4.0 / 3, epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[2], 8.0 / 9, epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[3], 4.0 / 3, epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[4], 2.0    , epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[5], 4.0 / 3, epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[6], 8.0 / 9, epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[7], 4.0 / 3, epsilon);
-//  EXPECT_NEAR(this->blob_top_->cpu_data()[8], 8.0 / 9, epsilon);
-//}
-
-
-
-
-
-
-
-
-
-
-
-
-
+TYPED_TEST(TemporalPoolingLayerTest, TestForwardAve) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TemporalPoolingParameter* pooling_param = layer_param.mutable_temporal_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(1);
+  pooling_param->set_pad(1);
+  pooling_param->set_group(3);
+  pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_AVE);
+  this->blob_bottom_->Reshape(1, 3, 3, 3);
+  FillerParameter filler_param;
+  filler_param.set_value(Dtype(2));
+  ConstantFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  TemporalPoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 1);
+  EXPECT_EQ(this->blob_top_->channels(), 3);
+  EXPECT_EQ(this->blob_top_->height(), 3);
+  EXPECT_EQ(this->blob_top_->width(), 3);
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  // the padded frames count in the average
+  Dtype epsilon = 1e-5;
+  for (int i = 0; i < 9; ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], 4.0 / 3, epsilon);
+    EXPECT_NEAR(this->blob_top_->cpu_data()[9 + i], 2.0, epsilon);
+    EXPECT_NEAR(this->blob_top_->cpu_data()[18 + i], 4.0 / 3, epsilon);
+  }
+}
 
+TYPED_TEST(TemporalPoolingLayerTest, TestGradientAve) {
+  typedef typename TypeParam::Dtype Dtype;
+  for (int kernel = 2; kernel <= 3; kernel++) {
+    LayerParameter layer_param;
+    TemporalPoolingParameter* pooling_param = layer_param.mutable_temporal_pooling_param();
+    pooling_param->set_kernel_size(kernel);
+    pooling_param->set_stride(2);
+    pooling_param->set_group(5);
+    pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_AVE);
+    TemporalPoolingLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-2);
+    checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+        &(this->blob_top_vec_));
+  }
+}
 
+TYPED_TEST(TemporalPoolingLayerTest, TestGradientAvePadded) {
+  typedef typename TypeParam::Dtype Dtype;
+  for (int kernel = 2; kernel <= 3; kernel++) {
+    LayerParameter layer_param;
+    TemporalPoolingParameter* pooling_param = layer_param.mutable_temporal_pooling_param();
+    pooling_param->set_kernel_size(kernel);
+    pooling_param->set_stride(1);
+    pooling_param->set_group(5);
+    pooling_param->set_pad(kernel - 1);
+    pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_AVE);
+    TemporalPoolingLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-2);
+    checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+        &(this->blob_top_vec_));
+  }
+}
 
+TYPED_TEST(TemporalPoolingLayerTest, TestForwardBackwardAve) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 16 frames of 2 x 2 x 3
+  this->blob_bottom_->Reshape(2, 48, 2, 3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  vector<bool> propagate_down(1, true);
+  // both the running sums (kernel > stride) and the plain sums
+  for (int kernel = 2; kernel <= 7; ++kernel) {
+    for (int stride = 1; stride <= kernel + 1; stride += 2) {
+      for (int pad = 0; pad < kernel; pad += kernel - 1) {
+        LayerParameter layer_param;
+        TemporalPoolingParameter* pooling_param =
+            layer_param.mutable_temporal_pooling_param();
+        pooling_param->set_kernel_size(kernel);
+        pooling_param->set_stride(stride);
+        pooling_param->set_group(16);
+        pooling_param->set_pad(pad);
+        pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_AVE);
+        TemporalPoolingLayer<Dtype> layer(layer_param);
+        layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+        filler.Fill(this->blob_top_);
+        caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+                   this->blob_top_->mutable_cpu_diff());
+        layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+        layer.Backward(this->blob_top_vec_, propagate_down,
+                       &(this->blob_bottom_vec_));
+        Blob<Dtype> ref_top, ref_bottom;
+        ref_top.ReshapeLike(*this->blob_top_);
+        caffe_temporal_ave_pool(this->blob_bottom_, *pooling_param,
+                                this->blob_top_, &ref_top, &ref_bottom);
+        for (int i = 0; i < this->blob_top_->count(); ++i) {
+          EXPECT_NEAR(this->blob_top_->cpu_data()[i], ref_top.cpu_data()[i],
+                      1e-5);
+        }
+        for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+          EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+                      ref_bottom.cpu_diff()[i], 1e-5);
+        }
+      }
+    }
+  }
+}
 
-//TYPED_TEST(TemporalPoolingLayerTest, TestGradientAve) {
-//  typedef typename TypeParam::Dtype Dtype;
-//  for (int kernel_h = 3; kernel_h <= 4; kernel_h++) {
-//    for (int kernel_w = 3; kernel_w <= 4; kernel_w++) {
-//      LayerParameter layer_param;
-//      TemporalPoolingParameter* pooling_param = layer_param.mutable_temporal_pooling_param();
-//      pooling_param->set_kernel_h(kernel_h);
-//      pooling_param->set_kernel_w(kernel_w);
-//      pooling_param->set_stride(2);
-//      pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_AVE);
-//      TemporalPoolingLayer<Dtype> layer(layer_param);
-//      GradientChecker<Dtype> checker(1e-2, 1e-2);
-//      checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
-//          &(this->blob_top_vec_));
-//    }
-//  }
-//}
-//
-//TYPED_TEST(TemporalPoolingLayerTest, TestGradientAvePadded) {
-//  typedef typename TypeParam::Dtype Dtype;
-//  for (int kernel_h = 3; kernel_h <= 4; kernel_h++) {
-//    for (int kernel_w = 3; kernel_w <= 4; kernel_w++) {
-//      LayerParameter layer_param;
-//      TemporalPoolingParameter* pooling_param = layer_param.mutable_temporal_pooling_param();
-//      pooling_param->set_kernel_h(kernel_h);
-//      pooling_param->set_kernel_w(kernel_w);
-//      pooling_param->set_stride(2);
-//      pooling_param->set_pad(2);
-//      pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_AVE);
-//      TemporalPoolingLayer<Dtype> layer(layer_param);
-//      GradientChecker<Dtype> checker(1e-2, 1e-2);
-//      checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
-//          &(this->blob_top_vec_));
-//    }
-//  }
-//}
+TYPED_TEST(TemporalPoolingLayerTest, TestForwardMaxTestPhase) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 16 frames of 2 x 2 x 3
+  this->blob_bottom_->Reshape(2, 48, 2, 3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  for (int stride = 1; stride <= 4; stride += 3) {
+    LayerParameter layer_param;
+    TemporalPoolingParameter* pooling_param =
+        layer_param.mutable_temporal_pooling_param();
+    pooling_param->set_kernel_size(3);
+    pooling_param->set_stride(stride);
+    pooling_param->set_group(16);
+    pooling_param->set_pad(1);
+    pooling_param->set_pool(TemporalPoolingParameter_PoolMethod_MAX);
+    TemporalPoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    Blob<Dtype> train_top;
+    train_top.CopyFrom(*this->blob_top_, false, true);
+    filler.Fill(&train_top);
+    caffe_copy(train_top.count(), train_top.cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   &(this->blob_bottom_vec_));
+    Blob<Dtype> train_bottom;
+    train_bottom.CopyFrom(*this->blob_bottom_, true, true);
+    train_top.CopyFrom(*this->blob_top_, false, true);
+    // TEST skips the mask but must pool the same values, and Backward must
+    // find the same frames
+    Caffe::set_phase(Caffe::TEST);
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Backward(this->blob_top_vec_, propagate_down,
+                   &(this->blob_bottom_vec_));
+    Caffe::set_phase(Caffe::TRAIN);
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_EQ(this->blob_top_->cpu_data()[i], train_top.cpu_data()[i]);
+    }
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_EQ(this->blob_bottom_->cpu_diff()[i],
+                train_bottom.cpu_diff()[i]);
+    }
+  }
+}
 
 }  // namespace caffe
@@ -0,0 +1,73 @@
+#include <boost/bind.hpp>
+
+#include <vector>
+
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {
+ public:
+  void Count(const int thread_id) {
+    ++counts_[thread_id];
+  }
+
+ protected:
+  vector<int> counts_;
+};
+
+TEST_F(ThreadPoolTest, TestEveryThreadRunsOnce) {
+  for (int num_threads = 1; num_threads <= 4; ++num_threads) {
+    ThreadPool pool(num_threads);
+    EXPECT_EQ(pool.num_threads(), num_threads);
+    counts_.assign(num_threads, 0);
+    pool.Run(boost::bind(&ThreadPoolTest::Count, this, _1));
+    for (int i = 0; i < num_threads; ++i) {
+      EXPECT_EQ(counts_[i], 1);
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestRepeatedRun) {
+  ThreadPool pool(3);
+  counts_.assign(3, 0);
+  for (int run = 0; run < 100; ++run) {
+    pool.Run(boost::bind(&ThreadPoolTest::Count, this, _1));
+  }
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(counts_[i], 100);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestThreadRange) {
+  // The ranges cover every item once, in order.
+  for (int num_threads = 1; num_threads <= 5; ++num_threads) {
+    int expected_begin = 0;
+    for (int thread_id = 0; thread_id < num_threads; ++thread_id) {
+      int begin, end;
+      ThreadRange(3, thread_id, num_threads, &begin, &end);
+      EXPECT_EQ(begin, expected_begin);
+      EXPECT_GE(end, begin);
+      EXPECT_LE(end - begin, (3 + num_threads - 1) / num_threads);
+      expected_begin = end;
+    }
+    EXPECT_EQ(expected_begin, 3);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestCaffeThreadPool) {
+  EXPECT_EQ(Caffe::cpu_threads(), 1);
+  EXPECT_EQ(Caffe::thread_pool().num_threads(), 1);
+  Caffe::set_cpu_threads(3);
+  EXPECT_EQ(Caffe::thread_pool().num_threads(), 3);
+  Caffe::set_cpu_threads(1);
+  EXPECT_EQ(Caffe::thread_pool().num_threads(), 1);
+}
+
+}  // namespace caffe
@@ -0,0 +1,230 @@
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class VideoDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  VideoDataLayerTest()
+      : seed_(1701),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    MakeTempDir(&video_dir_);
+    MakeTempFilename(&filename_);
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    Caffe::set_random_seed(seed_);
+    // Write a short synthetic clip whose frames are filled with their index.
+    const string video_name = video_dir_ + "/clip.avi";
+    cv::VideoWriter writer(video_name, CV_FOURCC('M', 'J', 'P', 'G'), 25,
+                           cv::Size(64, 48));
+    CHECK(writer.isOpened()) << "Failed to create " << video_name;
+    for (int f = 0; f < 20; ++f) {
+      writer << cv::Mat(48, 64, CV_8UC3, cv::Scalar(f * 10, f * 10, f * 10));
+    }
+    writer.release();
+    // Create a Vector of files with labels
+    std::ofstream outfile(filename_.c_str(), std::ofstream::out);
+    LOG(INFO) << "Using temporary file " << filename_;
+    for (int i = 0; i < 5; ++i) {
+      outfile << "clip.avi " << i << std::endl;
+    }
+    outfile.close();
+  }
+
+  virtual ~VideoDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  int seed_;
+  string video_dir_;
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(VideoDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(VideoDataLayerTest, TestRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  VideoDataParameter* video_data_param = param.mutable_video_data_param();
+  video_data_param->set_batch_size(5);
+  video_data_param->set_source(this->filename_.c_str());
+  video_data_param->set_root_folder(this->video_dir_ + "/");
+  video_data_param->set_shuffle(false);
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_is_video(true);
+  transform_param->set_video_crop_size_t(8);
+  transform_param->set_video_step_max(2);
+  VideoDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3 * 8);
+  EXPECT_EQ(this->blob_top_data_->height(), 48);
+  EXPECT_EQ(this->blob_top_data_->width(), 64);
+  EXPECT_EQ(this->blob_top_label_->num(), 5);
+  EXPECT_EQ(this->blob_top_label_->channels(), 1);
+  EXPECT_EQ(this->blob_top_label_->height(), 1);
+  EXPECT_EQ(this->blob_top_label_->width(), 1);
+  // Go through the data twice
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(VideoDataLayerTest, TestReadResizeCrop) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  VideoDataParameter* video_data_param = param.mutable_video_data_param();
+  video_data_param->set_batch_size(5);
+  video_data_param->set_source(this->filename_.c_str());
+  video_data_param->set_root_folder(this->video_dir_ + "/");
+  video_data_param->set_new_height(32);
+  video_data_param->set_new_width(40);
+  video_data_param->set_shuffle(true);
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_is_video(true);
+  transform_param->set_video_crop_size_t(4);
+  transform_param->set_crop_size(24);
+  VideoDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3 * 4);
+  EXPECT_EQ(this->blob_top_data_->height(), 24);
+  EXPECT_EQ(this->blob_top_data_->width(), 24);
+  // Go through the data twice
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    map<Dtype, int> values_to_indices;
+    for (int i = 0; i < 5; ++i) {
+      values_to_indices[this->blob_top_label_->cpu_data()[i]] = i;
+    }
+    // Every label shows up exactly once per epoch.
+    EXPECT_EQ(5, values_to_indices.size());
+  }
+}
+
+TYPED_TEST(VideoDataLayerTest, TestShuffleEpochs) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  VideoDataParameter* video_data_param = param.mutable_video_data_param();
+  // The epochs of 5 videos end partway through the batches of 3.
+  video_data_param->set_batch_size(3);
+  video_data_param->set_source(this->filename_.c_str());
+  video_data_param->set_root_folder(this->video_dir_ + "/");
+  video_data_param->set_shuffle(true);
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_is_video(true);
+  transform_param->set_video_crop_size_t(4);
+  VideoDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  vector<int> labels;
+  for (int iter = 0; iter < 5; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 3; ++i) {
+      labels.push_back(static_cast<int>(this->blob_top_label_->cpu_data()[i]));
+    }
+  }
+  // Every video shows up exactly once per epoch.
+  for (int epoch = 0; epoch < 3; ++epoch) {
+    std::set<int> epoch_labels(labels.begin() + epoch * 5,
+                               labels.begin() + (epoch + 1) * 5);
+    EXPECT_EQ(5, epoch_labels.size());
+  }
+}
+
+TYPED_TEST(VideoDataLayerTest, TestReadThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  VideoDataParameter* video_data_param = param.mutable_video_data_param();
+  video_data_param->set_batch_size(5);
+  video_data_param->set_source(this->filename_.c_str());
+  video_data_param->set_root_folder(this->video_dir_ + "/");
+  video_data_param->set_shuffle(false);
+  video_data_param->set_decode_threads(3);
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_is_video(true);
+  transform_param->set_video_crop_size_t(8);
+  VideoDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3 * 8);
+  // The decode threads must not reorder the batch.
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(VideoDataLayerTest, TestChannelMean) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_phase(Caffe::TEST);
+  BlobProto mean;
+  mean.set_num(1);
+  mean.set_channels(3);
+  mean.set_height(1);
+  mean.set_width(1);
+  for (int c = 0; c < 3; ++c) {
+    mean.add_data(c + 1);
+  }
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  WriteProtoToBinaryFile(mean, mean_file);
+  LayerParameter param;
+  VideoDataParameter* video_data_param = param.mutable_video_data_param();
+  video_data_param->set_batch_size(5);
+  video_data_param->set_source(this->filename_.c_str());
+  video_data_param->set_root_folder(this->video_dir_ + "/");
+  TransformationParameter* transform_param = param.mutable_transform_param();
+  transform_param->set_is_video(true);
+  transform_param->set_video_crop_size_t(4);
+  transform_param->set_crop_size(24);
+  VideoDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->blob_top_data_, false, true);
+  transform_param->set_mean_file(mean_file);
+  VideoDataLayer<Dtype> mean_layer(param);
+  mean_layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  mean_layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+  // Each channel is shifted by its own mean value.
+  const int plane_size = 24 * 24;
+  for (int i = 0; i < expected.count(); ++i) {
+    const int c = (i / plane_size) % 3;
+    EXPECT_EQ(expected.cpu_data()[i] - (c + 1),
+              this->blob_top_data_->cpu_data()[i]);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+}  // namespace caffe
@@ -0,0 +1,179 @@
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/video_io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class VideoIOTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // 6 frames of 3 x 4 x 5 bytes, every byte distinct within a frame
+    datum_.set_frames(6);
+    datum_.set_channels(3);
+    datum_.set_height(4);
+    datum_.set_width(5);
+    datum_.set_label(2);
+    string* data = datum_.mutable_data();
+    for (int i = 0; i < 6 * 3 * 4 * 5; ++i) {
+      data->push_back(static_cast<char>(i % 251));
+    }
+  }
+
+  // Writes a 20-frame 32x24 clip at 25 fps whose frames are filled with
+  // their index times 10.
+  void WriteClip(const string& video_name) {
+    cv::VideoWriter writer(video_name, CV_FOURCC('M', 'J', 'P', 'G'), 25,
+                           cv::Size(32, 24));
+    CHECK(writer.isOpened()) << "Failed to create " << video_name;
+    for (int f = 0; f < 20; ++f) {
+      writer << cv::Mat(24, 32, CV_8UC3, cv::Scalar(f * 10, f * 10, f * 10));
+    }
+  }
+
+  Datum datum_;
+};
+
+TEST_F(VideoIOTest, TestEncodeDecodeDatum) {
+  const string raw = datum_.data();
+  Datum datum = datum_;
+  // png is lossless, so the frames must come back unchanged
+  EXPECT_TRUE(EncodeVideoDatum("png", &datum));
+  EXPECT_EQ(datum.encoded_frames_size(), 6);
+  EXPECT_EQ(datum.data().size(), 0);
+  EXPECT_TRUE(DecodeVideoDatum(&datum));
+  EXPECT_EQ(datum.frames(), 6);
+  EXPECT_EQ(datum.encoded_frames_size(), 0);
+  EXPECT_EQ(datum.data(), raw);
+}
+
+TEST_F(VideoIOTest, TestDecodeFrames) {
+  const string raw = datum_.data();
+  const int frame_size = 3 * 4 * 5;
+  Datum datum = datum_;
+  EXPECT_TRUE(EncodeVideoDatum("png", &datum));
+  vector<int> frame_ids;
+  frame_ids.push_back(4);
+  frame_ids.push_back(-1);
+  frame_ids.push_back(1);
+  // the calls after the first reuse or resize the decode threads
+  const int num_threads[] = {2, 2, 3, 1};
+  for (int i = 0; i < 4; ++i) {
+    string buffer(frame_ids.size() * frame_size, 0);
+    EXPECT_TRUE(DecodeVideoFrames(datum, frame_ids, num_threads[i],
+                                  &buffer[0]));
+    EXPECT_EQ(buffer.substr(0, frame_size),
+              raw.substr(4 * frame_size, frame_size));
+    EXPECT_EQ(buffer.substr(frame_size, frame_size), string(frame_size, 0));
+    EXPECT_EQ(buffer.substr(2 * frame_size, frame_size),
+              raw.substr(frame_size, frame_size));
+  }
+}
+
+TEST_F(VideoIOTest, TestParseDatumHeader) {
+  const string serialized = datum_.SerializeAsString();
+  Datum header;
+  const char* data;
+  int data_size;
+  EXPECT_TRUE(ParseDatumHeader(serialized.data(), serialized.size(), &header,
+                               &data, &data_size));
+  EXPECT_EQ(header.frames(), 6);
+  EXPECT_EQ(header.channels(), 3);
+  EXPECT_EQ(header.height(), 4);
+  EXPECT_EQ(header.width(), 5);
+  EXPECT_EQ(header.label(), 2);
+  EXPECT_EQ(header.data().size(), 0);
+  // the data is not copied
+  EXPECT_GE(data, serialized.data());
+  EXPECT_LE(data + data_size, serialized.data() + serialized.size());
+  EXPECT_EQ(string(data, data_size), datum_.data());
+  // a datum without data, and a truncated one
+  Datum datum = datum_;
+  EXPECT_TRUE(EncodeVideoDatum("png", &datum));
+  const string encoded = datum.SerializeAsString();
+  EXPECT_TRUE(ParseDatumHeader(encoded.data(), encoded.size(), &header,
+                               &data, &data_size));
+  EXPECT_EQ(header.encoded_frames_size(), 6);
+  EXPECT_TRUE(data == NULL);
+  EXPECT_EQ(data_size, 0);
+  EXPECT_FALSE(ParseDatumHeader(serialized.data(), serialized.size() - 1,
+                                &header, &data, &data_size));
+}
+
+TEST_F(VideoIOTest, TestReadResampled) {
+  string video_dir;
+  MakeTempDir(&video_dir);
+  const string video_name = video_dir + "/clip.avi";
+  WriteClip(video_name);
+  DatumVideoReader reader;
+  Datum datum;
+  // 25 fps resampled to 12.5 keeps every other frame
+  EXPECT_TRUE(reader.ReadVideoToDatum(video_name, 1, 0, 0, false, 12.5, 0,
+                                      &datum));
+  EXPECT_EQ(datum.frames(), 10);
+  EXPECT_EQ(datum.data().size(), 10 * 24 * 32);
+  EXPECT_NEAR(static_cast<uint8_t>(datum.data()[2 * 24 * 32]), 40, 4);
+  // a higher rate than the source keeps every frame, up to max_frames
+  EXPECT_TRUE(reader.ReadVideoToDatum(video_name, 1, 0, 0, false, 60, 6,
+                                      &datum));
+  EXPECT_EQ(datum.frames(), 6);
+  remove(video_name.c_str());
+  rmdir(video_dir.c_str());
+}
+
+TEST_F(VideoIOTest, TestReadPastEnd) {
+  string video_dir;
+  MakeTempDir(&video_dir);
+  const string video_name = video_dir + "/clip.avi";
+  WriteClip(video_name);
+  DatumVideoReader reader;
+  Datum datum;
+  // a window past the last frame holds no frame, so there is nothing to read
+  EXPECT_FALSE(reader.ReadVideoWindow(video_name, 1, 30, 4, 1, 0, 0, false,
+                                      &datum));
+  EXPECT_TRUE(reader.ReadVideoWindow(video_name, 1, 16, 8, 1, 0, 0, false,
+                                     &datum));
+  EXPECT_EQ(datum.frames(), 4);
+  EXPECT_EQ(datum.height(), 24);
+  EXPECT_EQ(datum.width(), 32);
+  remove(video_name.c_str());
+  rmdir(video_dir.c_str());
+}
+
+TEST_F(VideoIOTest, TestReadResizeSide) {
+  string video_dir;
+  MakeTempDir(&video_dir);
+  const string video_name = video_dir + "/clip.avi";
+  WriteClip(video_name);
+  DatumVideoReader reader;
+  Datum datum;
+  // the aspect ratio is kept and the requested height and width are ignored
+  reader.set_resize_mode(DatumVideoReader::RESIZE_SHORT_SIDE, 12);
+  EXPECT_TRUE(reader.ReadVideoToDatum(video_name, 1, 100, 100, &datum));
+  EXPECT_EQ(datum.height(), 12);
+  EXPECT_EQ(datum.width(), 16);
+  EXPECT_EQ(datum.data().size(), 20 * 3 * 12 * 16);
+  reader.set_resize_mode(DatumVideoReader::RESIZE_MAX_SIDE, 64);
+  reader.set_interpolation(cv::INTER_CUBIC);
+  EXPECT_TRUE(reader.ReadVideoToDatum(video_name, 1, 100, 100, &datum));
+  EXPECT_EQ(datum.height(), 48);
+  EXPECT_EQ(datum.width(), 64);
+  reader.set_resize_mode(DatumVideoReader::RESIZE_EXACT, 0);
+  EXPECT_TRUE(reader.ReadVideoToDatum(video_name, 1, 10, 20, &datum));
+  EXPECT_EQ(datum.height(), 10);
+  EXPECT_EQ(datum.width(), 20);
+  remove(video_name.c_str());
+  rmdir(video_dir.c_str());
+}
+
+}  // namespace caffe
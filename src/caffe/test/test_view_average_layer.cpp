@@ -0,0 +1,99 @@
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class ViewAverageLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  ViewAverageLayerTest()
+      : blob_bottom_(new Blob<Dtype>(6, 4, 2, 3)),
+        blob_bottom_label_(new Blob<Dtype>(6, 1, 1, 1)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {
+    Caffe::set_random_seed(1701);
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    // two samples of three views each
+    for (int i = 0; i < 6; ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] = i / 3 + 5;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~ViewAverageLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_label_;
+    delete blob_top_;
+    delete blob_top_label_;
+  }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(ViewAverageLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(ViewAverageLayerTest, TestSetup) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_view_average_param()->set_num_views(3);
+  ViewAverageLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 4);
+  EXPECT_EQ(this->blob_top_->height(), 2);
+  EXPECT_EQ(this->blob_top_->width(), 3);
+}
+
+TYPED_TEST(ViewAverageLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_view_average_param()->set_num_views(3);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_label_);
+  this->blob_top_vec_.push_back(this->blob_top_label_);
+  ViewAverageLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const int dim = 4 * 2 * 3;
+  for (int n = 0; n < 2; ++n) {
+    for (int j = 0; j < dim; ++j) {
+      Dtype expected = 0;
+      for (int v = 0; v < 3; ++v) {
+        expected += this->blob_bottom_->cpu_data()[(n * 3 + v) * dim + j];
+      }
+      EXPECT_NEAR(expected / 3, this->blob_top_->cpu_data()[n * dim + j],
+                  1e-5);
+    }
+    // the views of a sample share its label
+    EXPECT_NEAR(n + 5, this->blob_top_label_->cpu_data()[n], 1e-5);
+  }
+}
+
+TYPED_TEST(ViewAverageLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_view_average_param()->set_num_views(3);
+  ViewAverageLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+}  // namespace caffe
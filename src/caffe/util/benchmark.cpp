@@ -94,4 +94,21 @@ void Timer::Init() {
   }
 }
 
+void CPUTimer::Start() {
+  start_cpu_ = boost::posix_time::microsec_clock::local_time();
+  running_ = true;
+}
+
+void CPUTimer::Stop() {
+  if (running_) {
+    stop_cpu_ = boost::posix_time::microsec_clock::local_time();
+    running_ = false;
+  }
+}
+
+float CPUTimer::MilliSeconds() {
+  Stop();
+  return (stop_cpu_ - start_cpu_).total_microseconds() / 1000.;
+}
+
 }  // namespace caffe
@@ -2,6 +2,7 @@
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <leveldb/db.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -27,6 +28,7 @@ using google::protobuf::io::CodedInputStream;
 using google::protobuf::io::ZeroCopyOutputStream;
 using google::protobuf::io::CodedOutputStream;
 using google::protobuf::Message;
+using google::protobuf::internal::WireFormatLite;
 
 bool ReadProtoFromTextFile(const char* filename, Message* proto) {
   int fd = open(filename, O_RDONLY);
@@ -66,6 +68,55 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
+// Merges the serialized Datum fields in [begin, end) into datum.
+static bool MergeDatumFields(const uint8_t* begin, const uint8_t* end,
+    Datum* datum) {
+  const int size = end - begin;
+  CodedInputStream input(begin, size);
+  input.SetTotalBytesLimit(size, size);
+  return datum->MergePartialFromCodedStream(&input) &&
+      input.ConsumedEntireMessage();
+}
+
+bool ParseDatumHeader(const void* buffer, const int size, Datum* header,
+    const char** data, int* data_size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+  CodedInputStream input(bytes, size);
+  input.SetTotalBytesLimit(size, size);
+  header->Clear();
+  *data = NULL;
+  *data_size = 0;
+  // Start of the fields not merged into header yet
+  int fields_begin = 0;
+  while (true) {
+    const int field_begin = input.CurrentPosition();
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0) {
+      break;
+    }
+    if (WireFormatLite::GetTagFieldNumber(tag) == Datum::kDataFieldNumber &&
+        WireFormatLite::GetTagWireType(tag) ==
+        WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      uint32_t length;
+      if (!input.ReadVarint32(&length) ||
+          !MergeDatumFields(bytes + fields_begin, bytes + field_begin,
+                            header)) {
+        return false;
+      }
+      *data = reinterpret_cast<const char*>(bytes + input.CurrentPosition());
+      *data_size = length;
+      if (!input.Skip(length)) {
+        return false;
+      }
+      fields_begin = input.CurrentPosition();
+    } else if (!WireFormatLite::SkipField(&input, tag)) {
+      return false;
+    }
+  }
+  return input.ConsumedEntireMessage() &&
+      MergeDatumFields(bytes + fields_begin, bytes + size, header);
+}
+
 bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color, Datum* datum) {
   cv::Mat cv_img;
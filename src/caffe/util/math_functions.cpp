@@ -1,6 +1,12 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -35,6 +41,24 @@ void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       ldb, beta, C, N);
 }
 
+template<>
+void caffe_cpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float* A, const int lda, const float* B,
+    const int ldb, const float beta, float* C, const int ldc) {
+  cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+      ldb, beta, C, ldc);
+}
+
+template<>
+void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double* A, const int lda, const double* B,
+    const int ldb, const double beta, double* C, const int ldc) {
+  cblas_dgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
+      ldb, beta, C, ldc);
+}
+
 template <>
 void caffe_cpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
     const int N, const float alpha, const float* A, const float* x,
@@ -498,4 +522,74 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+// Elements [begin, n) of caffe_cpu_uint8_sub_scale.
+template <typename Dtype>
+static void uint8_sub_scale_tail(const int begin, const int n,
+    const uint8_t* x, const Dtype* mean, const int mean_step,
+    const Dtype scale, const bool reverse, Dtype* y) {
+  for (int i = begin; i < n; ++i) {
+    y[reverse ? n - 1 - i : i] =
+        (static_cast<Dtype>(x[i]) - mean[i * mean_step]) * scale;
+  }
+}
+
+template <>
+void caffe_cpu_uint8_sub_scale<float>(const int n, const uint8_t* x,
+    const float* mean, const int mean_step, const float scale,
+    const bool reverse, float* y) {
+  DCHECK(mean_step == 0 || mean_step == 1);
+  int i = 0;
+#if defined(__AVX2__)
+  const __m256 scale8 = _mm256_set1_ps(scale);
+  const __m256 mean8 = _mm256_set1_ps(mean[0]);
+  const __m256i reversed = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  for (; i + 8 <= n; i += 8) {
+    const __m128i bytes =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + i));
+    __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    v = _mm256_sub_ps(v, mean_step ? _mm256_loadu_ps(mean + i) : mean8);
+    v = _mm256_mul_ps(v, scale8);
+    if (reverse) {
+      _mm256_storeu_ps(y + n - 8 - i, _mm256_permutevar8x32_ps(v, reversed));
+    } else {
+      _mm256_storeu_ps(y + i, v);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128 mean4 = _mm_set1_ps(mean[0]);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+    const __m128i ints[4] = {
+      _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+      _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)
+    };
+    for (int k = 0; k < 4; ++k) {
+      const int j = i + 4 * k;
+      __m128 v = _mm_cvtepi32_ps(ints[k]);
+      v = _mm_sub_ps(v, mean_step ? _mm_loadu_ps(mean + j) : mean4);
+      v = _mm_mul_ps(v, scale4);
+      if (reverse) {
+        _mm_storeu_ps(y + n - 4 - j,
+                      _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3)));
+      } else {
+        _mm_storeu_ps(y + j, v);
+      }
+    }
+  }
+#endif
+  uint8_sub_scale_tail(i, n, x, mean, mean_step, scale, reverse, y);
+}
+
+template <>
+void caffe_cpu_uint8_sub_scale<double>(const int n, const uint8_t* x,
+    const double* mean, const int mean_step, const double scale,
+    const bool reverse, double* y) {
+  uint8_sub_scale_tail(0, n, x, mean, mean_step, scale, reverse, y);
+}
+
 }  // namespace caffe
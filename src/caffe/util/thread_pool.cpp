@@ -0,0 +1,87 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  boost::mutex run_mutex_;
+  boost::mutex mutex_;
+  boost::condition_variable work_condition_;
+  boost::condition_variable done_condition_;
+  boost::thread_group workers_;
+  boost::function<void(int)> task_;
+  // Bumped by every Run, so that a worker runs each task exactly once.
+  int generation_;
+  int pending_;
+  bool stop_;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(num_threads), sync_(new sync()) {
+  CHECK_GT(num_threads, 0);
+  sync_->generation_ = 0;
+  sync_->pending_ = 0;
+  sync_->stop_ = false;
+  for (int thread_id = 1; thread_id < num_threads; ++thread_id) {
+    sync_->workers_.create_thread(
+        boost::bind(&ThreadPool::WorkerEntry, this, thread_id));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->stop_ = true;
+  }
+  sync_->work_condition_.notify_all();
+  sync_->workers_.join_all();
+}
+
+void ThreadPool::Run(const boost::function<void(int)>& task) {
+  boost::mutex::scoped_lock run_lock(sync_->run_mutex_);
+  if (num_threads_ == 1) {
+    task(0);
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    sync_->task_ = task;
+    sync_->pending_ = num_threads_ - 1;
+    ++sync_->generation_;
+  }
+  sync_->work_condition_.notify_all();
+  task(0);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (sync_->pending_ > 0) {
+    sync_->done_condition_.wait(lock);
+  }
+  sync_->task_.clear();
+}
+
+void ThreadPool::WorkerEntry(int thread_id) {
+  int generation = 0;
+  while (true) {
+    boost::function<void(int)> task;
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      while (!sync_->stop_ && sync_->generation_ == generation) {
+        sync_->work_condition_.wait(lock);
+      }
+      if (sync_->stop_) {
+        return;
+      }
+      generation = sync_->generation_;
+      task = sync_->task_;
+    }
+    task(thread_id);
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    if (--sync_->pending_ == 0) {
+      sync_->done_condition_.notify_one();
+    }
+  }
+}
+
+}  // namespace caffe
@@ -3,11 +3,19 @@
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
+#include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/video_io.hpp"
 
 namespace caffe {
@@ -19,86 +27,334 @@ DatumVideoReader::~DatumVideoReader() {
   }
 }
 
+// Writes the planes of img (1 or 3 channels) one after another at dst.
+static void CopyPlanesToBuffer(const cv::Mat& img, char* dst,
+     std::vector<cv::Mat>* planes) {
+  const int plane_size = img.rows * img.cols;
+  uchar* dst_data = reinterpret_cast<uchar*>(dst);
+  if (img.channels() == 3) {
+    // Wrap each destination plane so that cv::split deinterleaves the frame
+    // directly into the datum buffer.
+    planes->resize(3);
+    for (int c = 0; c < 3; ++c) {
+      (*planes)[c] = cv::Mat(img.rows, img.cols, CV_8UC1,
+                             dst_data + c * plane_size);
+    }
+    cv::split(img, *planes);
+  } else {
+    CHECK_EQ(img.channels(), 1) << "Expected a BGR or gray frame";
+    if (img.isContinuous()) {
+      memcpy(dst_data, img.data, plane_size);
+    } else {
+      for (int h = 0; h < img.rows; ++h) {
+        memcpy(dst_data + h * img.cols, img.ptr<uchar>(h), img.cols);
+      }
+    }
+  }
+}
+
+void DatumVideoReader::CopyFrameToBuffer(const cv::Mat& img,
+     const bool is_color, char* dst) {
+  if (is_color) {
+    CHECK_EQ(img.channels(), 3) << "Expected a BGR frame";
+    CopyPlanesToBuffer(img, dst, &planes);
+  } else if (img.channels() != 1) {
+    cv::cvtColor(img, gray, CV_BGR2GRAY);
+    CopyPlanesToBuffer(gray, dst, &planes);
+  } else {
+    CopyPlanesToBuffer(img, dst, &planes);
+  }
+}
+
 bool DatumVideoReader::ReadVideoToDatum(const string& filename, const int label,
      const int height, const int width, const bool is_color, Datum* datum) {
+  return ReadVideoWindow(filename, label, 0, 0, 1, height, width, is_color,
+                         datum);
+}
+
+bool DatumVideoReader::ReadVideoToDatum(const string& filename, const int label,
+     const int height, const int width, const bool is_color, const float fps,
+     const int max_frames, Datum* datum) {
+  return ReadFrames(filename, label, 0, max_frames, 1, fps, height, width,
+                    is_color, datum);
+}
+
+bool DatumVideoReader::ReadVideoWindow(const string& filename, const int label,
+     const int start_frame, const int num_frames, const int step,
+     const int height, const int width, const bool is_color, Datum* datum) {
+  return ReadFrames(filename, label, start_frame, num_frames, step, 0, height,
+                    width, is_color, datum);
+}
+
+bool DatumVideoReader::ReadFrames(const string& filename, const int label,
+     const int start_frame, const int num_frames, const int step,
+     const float fps, const int height, const int width, const bool is_color,
+     Datum* datum) {
+  CHECK_GE(start_frame, 0) << "start_frame must be non-negative";
+  CHECK_GT(step, 0) << "step must be greater than zero";
+  if (timings_) {
+    stage_start_ = boost::posix_time::microsec_clock::local_time();
+  }
   reader.open(filename);
   if(!reader.isOpened()) {
     LOG(ERROR) << "Could not open or find file " << filename;
     return false;
   }
-  int num_frames = reader.get(CV_CAP_PROP_FRAME_COUNT);
-  int _height = reader.get(CV_CAP_PROP_FRAME_HEIGHT);
-  int _width = reader.get(CV_CAP_PROP_FRAME_WIDTH);
+  int total_frames = reader.get(CV_CAP_PROP_FRAME_COUNT);
+  // Frame k is source frame start_frame + floor(k * frame_step + 0.5); the
+  // step is fractional when resampling to a lower frame rate.
+  double frame_step = step;
+  const double source_fps = reader.get(CV_CAP_PROP_FPS);
+  if (fps > 0 && source_fps > fps) {
+    frame_step *= source_fps / fps;
+  }
 
-  bool need_resize = false;
-  if (height > 0 && width >0 && (height != _height || width != _width)) {
-    need_resize = true;
-    _height = height;
-    _width = width;
-  } 
+  // Number of frames to decode, or -1 to read until the clip runs out when
+  // neither the caller nor the container gives a bound.
+  int expected_frames = -1;
+  if (total_frames > start_frame) {
+    expected_frames = static_cast<int>(
+        ceil((total_frames - start_frame - 0.5) / frame_step));
+  } else if (total_frames > 0) {
+    expected_frames = 0;
+  }
+  if (num_frames > 0 && (expected_frames < 0 || num_frames < expected_frames)) {
+    expected_frames = num_frames;
+  }
+  if (start_frame > 0) {
+    reader.set(CV_CAP_PROP_POS_FRAMES, start_frame);
+  }
+  EndStage(&VideoStageTimings::open_us);
 
   int num_channels = (is_color ? 3 : 1);
   datum->clear_data();
   datum->clear_float_data();
   string* datum_string = datum->mutable_data();
+  // The frame geometry is taken from the first decoded frame, since some
+  // containers report a size of 0.
+  int source_height = 0;
+  int source_width = 0;
+  cv::Size size;
+  bool need_resize = false;
+  int interpolation = interpolation_;
+  size_t frame_size = 0;
 
   int frame_cnt = 0;
+  // offset from start_frame of the last frame read
+  int source_offset = 0;
 
-  for (int frame_id = 0; frame_id < num_frames; ++frame_id) {
-    reader>>frame;
-    if (!frame.empty()) {
-      frame_cnt++;
-      if (need_resize) {
-        cv::resize(frame, img, cv::Size(_width, _height));
-      } else {
-        img = frame;
+  for (int frame_id = 0; expected_frames < 0 || frame_id < expected_frames;
+       ++frame_id) {
+    // skip the frames between two sampled ones without decoding them
+    const int next_offset =
+        static_cast<int>(floor(frame_id * frame_step + 0.5));
+    bool skipped = true;
+    for (int s = source_offset + 1; frame_id > 0 && s < next_offset; ++s) {
+      if (!reader.grab()) {
+        skipped = false;
+        break;
       }
-
-      if (is_color) {
-        for (int c = 0; c < num_channels; ++c) {
-          for (int h = 0; h < _height; ++h) {
-            for (int w = 0; w < _width; ++w) {
-              datum_string->push_back(
-                static_cast<char>(img.at<cv::Vec3b>(h, w)[c]));
-            }
-          }
-        }
-      } else {  // Faster than repeatedly testing is_color for each pixel w/i loop
-        for (int h = 0; h < _height; ++h) {
-          for (int w = 0; w < _width; ++w) {
-            datum_string->push_back(
-              static_cast<char>(img.at<uchar>(h, w)));
-            }
-          }
+    }
+    source_offset = next_offset;
+    if (skipped) {
+      reader>>frame;
+    }
+    EndStage(&VideoStageTimings::decode_us);
+    if (!skipped || frame.empty()) {
+      if (expected_frames > 0) {
+        LOG(ERROR) << "empty frame in " << filename << " : "
+                   << (start_frame + source_offset + 1) << "/"
+                   << total_frames;
       }
-
-    } else {
-      LOG(ERROR) << "empty frame in " << filename << " : " << (frame_id + 1) << "/" << num_frames;
       break;
     }
+    if (frame_cnt == 0) {
+      source_height = frame.rows;
+      source_width = frame.cols;
+      size = ResizedSize(source_height, source_width, height, width);
+      need_resize = (size.height != source_height ||
+                     size.width != source_width);
+      if (interpolation < 0) {
+        interpolation = (size.area() < source_height * source_width) ?
+            cv::INTER_AREA : cv::INTER_LINEAR;
+      }
+      frame_size = static_cast<size_t>(num_channels) * size.area();
+      // Size the whole payload once from the expected frame count. Some
+      // containers misreport it, so the buffer is grown or trimmed below if
+      // the decoded count differs.
+      datum_string->resize(std::max(expected_frames, 1) * frame_size);
+    } else if (frame.rows != source_height || frame.cols != source_width) {
+      LOG(ERROR) << "Frame size changed from " << source_height << "x"
+                 << source_width << " to " << frame.rows << "x" << frame.cols
+                 << " in " << filename;
+      reader.release();
+      return false;
+    }
+    // Resize into img, but never alias it to frame, so that both keep their
+    // own buffer from one video to the next.
+    const cv::Mat* sized = &frame;
+    if (need_resize) {
+      cv::resize(frame, img, size, 0, 0, interpolation);
+      sized = &img;
+      EndStage(&VideoStageTimings::resize_us);
+    }
+
+    const size_t offset = frame_cnt * frame_size;
+    if (datum_string->size() < offset + frame_size) {
+      datum_string->resize(offset + frame_size);
+    }
+    CopyFrameToBuffer(*sized, is_color, &(*datum_string)[offset]);
+    EndStage(&VideoStageTimings::pack_us);
+    frame_cnt++;
+  }
+  if (timings_) {
+    timings_->frames += frame_cnt;
   }
   reader.release();
+  if (frame_cnt == 0) {
+    LOG(ERROR) << "No frame could be read from " << filename;
+    return false;
+  }
+  datum_string->resize(frame_cnt * frame_size);
 
   datum->set_frames(frame_cnt);
   datum->set_channels(num_channels);
-  datum->set_height(_height);
-  datum->set_width(_width);
+  datum->set_height(size.height);
+  datum->set_width(size.width);
   datum->set_label(label);
 
   return true;
-   
 }
 
-inline bool DatumVideoReader::ReadVideoToDatum(const string& filename, const int label,
-     const int height, const int width, Datum* datum) {
-  return ReadVideoToDatum(filename, label, height, width, true, datum);
+cv::Size DatumVideoReader::ResizedSize(const int source_height,
+     const int source_width, const int height, const int width) const {
+  if (resize_mode_ == RESIZE_EXACT || source_height <= 0 ||
+      source_width <= 0) {
+    if (height > 0 && width > 0) {
+      return cv::Size(width, height);
+    }
+    return cv::Size(source_width, source_height);
+  }
+  const int side = (resize_mode_ == RESIZE_SHORT_SIDE) ?
+      std::min(source_height, source_width) :
+      std::max(source_height, source_width);
+  const double scale = static_cast<double>(resize_side_) / side;
+  return cv::Size(std::max(1, static_cast<int>(source_width * scale + 0.5)),
+                  std::max(1, static_cast<int>(source_height * scale + 0.5)));
 }
 
-inline bool DatumVideoReader::ReadVideoToDatum(const string& filename, const int label,
-     Datum* datum) {
-  return ReadVideoToDatum(filename, label, 0, 0, true, datum);
-  
+int DatumVideoReader::CountFrames(const string& filename) {
+  reader.open(filename);
+  if(!reader.isOpened()) {
+    LOG(ERROR) << "Could not open or find file " << filename;
+    return -1;
+  }
+  int total_frames = reader.get(CV_CAP_PROP_FRAME_COUNT);
+  reader.release();
+  return std::max(total_frames, 0);
 }
 
+bool EncodeVideoDatum(const string& format, Datum* datum) {
+  const int channels = datum->channels();
+  const int height = datum->height();
+  const int width = datum->width();
+  const int frame_size = channels * height * width;
+  CHECK(channels == 1 || channels == 3) << "Cannot encode " << channels
+      << "-channel frames";
+  const string& data = datum->data();
+  CHECK_EQ(data.size(), datum->frames() * frame_size)
+      << "Only raw uint8 video datums can be encoded";
+  const string ext = "." + format;
+  std::vector<cv::Mat> planes(channels);
+  cv::Mat img;
+  std::vector<uchar> buf;
+  datum->clear_encoded_frames();
+  for (int f = 0; f < datum->frames(); ++f) {
+    uchar* frame_data =
+        reinterpret_cast<uchar*>(const_cast<char*>(data.data())) +
+        f * frame_size;
+    for (int c = 0; c < channels; ++c) {
+      planes[c] = cv::Mat(height, width, CV_8UC1,
+                          frame_data + c * height * width);
+    }
+    cv::merge(planes, img);
+    if (!cv::imencode(ext, img, buf)) {
+      LOG(ERROR) << "Could not encode frame " << f << " as " << format;
+      datum->clear_encoded_frames();
+      return false;
+    }
+    datum->add_encoded_frames(reinterpret_cast<char*>(&buf[0]), buf.size());
+  }
+  datum->clear_data();
+  return true;
+}
+
+// Decodes every num_threads-th entry of frame_ids, starting at thread_id, and
+// sets ok[thread_id] to whether they all decoded.
+static void DecodeVideoFrameShare(const Datum& datum,
+    const std::vector<int>& frame_ids, const int num_threads, char* dst,
+    int* ok, const int thread_id) {
+  const int frame_size = datum.channels() * datum.height() * datum.width();
+  const int flags =
+      datum.channels() == 3 ? CV_LOAD_IMAGE_COLOR : CV_LOAD_IMAGE_GRAYSCALE;
+  std::vector<cv::Mat> planes;
+  ok[thread_id] = true;
+  for (int i = thread_id; i < frame_ids.size(); i += num_threads) {
+    if (frame_ids[i] < 0) {
+      continue;
+    }
+    CHECK_LT(frame_ids[i], datum.encoded_frames_size());
+    const string& encoded = datum.encoded_frames(frame_ids[i]);
+    cv::Mat img = cv::imdecode(cv::Mat(1, encoded.size(), CV_8UC1,
+        const_cast<char*>(encoded.data())), flags);
+    if (img.rows != datum.height() || img.cols != datum.width()) {
+      LOG(ERROR) << "Could not decode frame " << frame_ids[i];
+      ok[thread_id] = false;
+      return;
+    }
+    CopyPlanesToBuffer(img, dst + static_cast<size_t>(i) * frame_size,
+                       &planes);
+  }
+}
+
+// The decode threads of each calling thread. They live as long as the caller,
+// usually a prefetch thread, so a datum does not start and join threads.
+static boost::thread_specific_ptr<ThreadPool> decode_pool;
+
+bool DecodeVideoFrames(const Datum& datum, const std::vector<int>& frame_ids,
+    const int num_threads, char* dst) {
+  const int threads = std::max(1, std::min<int>(num_threads,
+                                                frame_ids.size()));
+  std::vector<int> ok(threads);
+  if (threads == 1) {
+    DecodeVideoFrameShare(datum, frame_ids, 1, dst, &ok[0], 0);
+    return ok[0];
+  }
+  if (!decode_pool.get() || decode_pool->num_threads() != threads) {
+    decode_pool.reset(new ThreadPool(threads));
+  }
+  decode_pool->Run(boost::bind(&DecodeVideoFrameShare, boost::cref(datum),
+      boost::cref(frame_ids), threads, dst, &ok[0], _1));
+  return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+bool DecodeVideoDatum(Datum* datum) {
+  const int frames = datum->encoded_frames_size();
+  const size_t frame_size =
+      static_cast<size_t>(datum->channels()) * datum->height() * datum->width();
+  std::vector<int> frame_ids(frames);
+  for (int f = 0; f < frames; ++f) {
+    frame_ids[f] = f;
+  }
+  string* data = datum->mutable_data();
+  data->resize(frames * frame_size);
+  if (!DecodeVideoFrames(*datum, frame_ids, 1, &(*data)[0])) {
+    datum->clear_data();
+    return false;
+  }
+  datum->set_frames(frames);
+  datum->clear_encoded_frames();
+  return true;
+}
 
 }  // namespace caffe
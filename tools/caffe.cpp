@@ -30,6 +30,9 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(cpu_threads, 1,
+    "Threads that the CPU code of the temporal layers splits the batch over; "
+    "0 uses one per core.");
 
 
 shared_ptr<caffe::Solver<float> > g_solver;
@@ -118,6 +121,7 @@ int train() {
   } else {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    Caffe::set_cpu_threads(FLAGS_cpu_threads);
   }
 
   LOG(INFO) << "Starting Optimization";
@@ -154,6 +158,7 @@ int test() {
   } else {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    Caffe::set_cpu_threads(FLAGS_cpu_threads);
   }
   // Instantiate the caffe net.
   Caffe::set_phase(Caffe::TEST);
@@ -220,6 +225,7 @@ int time() {
   } else {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    Caffe::set_cpu_threads(FLAGS_cpu_threads);
   }
   // Instantiate the caffe net.
   Caffe::set_phase(Caffe::TRAIN);
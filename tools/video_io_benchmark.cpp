@@ -0,0 +1,177 @@
+// This program measures how fast DatumVideoReader turns videos into Datums.
+// Usage:
+//   video_io_benchmark [FLAGS]
+//
+// It writes --clips synthetic clips to a temporary directory, so the numbers
+// only depend on the machine and the OpenCV build, not on a dataset. It then
+// reports the time per frame of every stage of a single reader, and the
+// frames per second of 1, 2, 4, ... up to --threads readers running in
+// parallel.
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/video_io.hpp"
+
+using caffe::Datum;
+using caffe::DatumVideoReader;
+using caffe::VideoStageTimings;
+using std::string;
+using std::vector;
+
+DEFINE_int32(clips, 8, "Number of synthetic clips");
+DEFINE_int32(frames, 150, "Number of frames of each clip");
+DEFINE_int32(width, 320, "Width of the clips");
+DEFINE_int32(height, 240, "Height of the clips");
+DEFINE_int32(resize_width, 171, "Width the frames are resized to; 0 keeps it");
+DEFINE_int32(resize_height, 128,
+    "Height the frames are resized to; 0 keeps it");
+DEFINE_bool(gray, false, "Read the clips as grayscale");
+DEFINE_int32(passes, 4, "Number of times every clip is read per measurement");
+DEFINE_int32(threads, boost::thread::hardware_concurrency(),
+    "Largest number of reader threads measured");
+
+// Writes a clip of moving gradients, which compresses like natural video
+// rather than like noise or a constant image.
+static void WriteClip(const string& filename) {
+  cv::VideoWriter writer(filename, CV_FOURCC('M', 'J', 'P', 'G'), 25,
+                         cv::Size(FLAGS_width, FLAGS_height));
+  CHECK(writer.isOpened()) << "Failed to create " << filename;
+  cv::Mat frame(FLAGS_height, FLAGS_width, CV_8UC3);
+  for (int f = 0; f < FLAGS_frames; ++f) {
+    for (int h = 0; h < FLAGS_height; ++h) {
+      uchar* row = frame.ptr<uchar>(h);
+      for (int w = 0; w < FLAGS_width; ++w) {
+        row[3 * w] = static_cast<uchar>(w + 2 * f);
+        row[3 * w + 1] = static_cast<uchar>(h + f);
+        row[3 * w + 2] = static_cast<uchar>((w + h) / 2 + 3 * f);
+      }
+    }
+    writer << frame;
+  }
+}
+
+static float MilliSecondsSince(const boost::posix_time::ptime& start) {
+  return (boost::posix_time::microsec_clock::local_time() - start)
+      .total_microseconds() / 1000.;
+}
+
+// Reads every num_threads-th of the clips x passes videos, starting at
+// thread_id, and counts the frames read.
+static void ReadClips(const vector<string>& clips, const int thread_id,
+    const int num_threads, int64_t* frames) {
+  DatumVideoReader reader;
+  Datum datum;
+  *frames = 0;
+  for (int i = thread_id; i < clips.size() * FLAGS_passes; i += num_threads) {
+    CHECK(reader.ReadVideoToDatum(clips[i % clips.size()], 0,
+        FLAGS_resize_height, FLAGS_resize_width, !FLAGS_gray, &datum));
+    *frames += datum.frames();
+  }
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Measure the speed of DatumVideoReader\n"
+        "Usage:\n"
+        "    video_io_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_clips, 0);
+  CHECK_GT(FLAGS_frames, 0);
+  CHECK_GT(FLAGS_passes, 0);
+  const int max_threads = std::max(FLAGS_threads, 1);
+
+  string clip_dir;
+  caffe::MakeTempDir(&clip_dir);
+  LOG(INFO) << "Writing " << FLAGS_clips << " clips of " << FLAGS_frames
+            << " frames of " << FLAGS_width << "x" << FLAGS_height << " to "
+            << clip_dir;
+  vector<string> clips;
+  for (int i = 0; i < FLAGS_clips; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "/clip_%03d.avi", i);
+    clips.push_back(clip_dir + name);
+    WriteClip(clips.back());
+  }
+
+  // Read every clip once to warm up the file cache.
+  DatumVideoReader reader;
+  Datum datum;
+  for (int i = 0; i < clips.size(); ++i) {
+    CHECK(reader.ReadVideoToDatum(clips[i], 0, FLAGS_resize_height,
+        FLAGS_resize_width, !FLAGS_gray, &datum));
+  }
+
+  // Stages of a single reader
+  VideoStageTimings timings;
+  reader.set_stage_timings(&timings);
+  for (int pass = 0; pass < FLAGS_passes; ++pass) {
+    for (int i = 0; i < clips.size(); ++i) {
+      CHECK(reader.ReadVideoToDatum(clips[i], 0, FLAGS_resize_height,
+          FLAGS_resize_width, !FLAGS_gray, &datum));
+    }
+  }
+  const float total_us = timings.open_us + timings.decode_us +
+      timings.resize_us + timings.pack_us;
+  LOG(INFO) << "Stages of one reader over " << timings.frames << " frames:";
+  LOG(INFO) << "  open:   " << timings.open_us / 1000. / clips.size()
+            / FLAGS_passes << " ms per clip";
+  LOG(INFO) << "  decode: " << timings.decode_us / 1000. / timings.frames
+            << " ms per frame";
+  LOG(INFO) << "  resize: " << timings.resize_us / 1000. / timings.frames
+            << " ms per frame";
+  LOG(INFO) << "  pack:   " << timings.pack_us / 1000. / timings.frames
+            << " ms per frame";
+  LOG(INFO) << "  total:  " << timings.frames / (total_us / 1000000.)
+            << " frames/sec";
+
+  // Throughput of parallel readers
+  vector<int> thread_counts;
+  for (int threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(max_threads);
+  for (int t = 0; t < thread_counts.size(); ++t) {
+    const int num_threads = thread_counts[t];
+    vector<int64_t> thread_frames(num_threads);
+    const boost::posix_time::ptime start =
+        boost::posix_time::microsec_clock::local_time();
+    boost::thread_group threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.create_thread(boost::bind(&ReadClips, boost::cref(clips), i,
+          num_threads, &thread_frames[i]));
+    }
+    threads.join_all();
+    const float elapsed_ms = MilliSecondsSince(start);
+    int64_t frames_read = 0;
+    for (int i = 0; i < num_threads; ++i) {
+      frames_read += thread_frames[i];
+    }
+    LOG(INFO) << num_threads << " threads: "
+              << frames_read / (elapsed_ms / 1000.) << " frames/sec";
+  }
+
+  for (int i = 0; i < clips.size(); ++i) {
+    remove(clips[i].c_str());
+  }
+  rmdir(clip_dir.c_str());
+  return 0;
+}